@@ -34,9 +34,8 @@ int main(int argc, char* argv[]) {
         goto error;
     }
 
-    // 分配字符串内存空间
+    // 分配字符串内存空间，输出的字符串在解码后按蓝图的大小分配
     char* str_i = (char*)calloc(BLUEPRINT_MAX_LENGTH, sizeof(char));
-    char* str_o = (char*)calloc(BLUEPRINT_MAX_LENGTH, sizeof(char));
 
     // 读取字符串
     fscanf(fpi, "%s", str_i);
@@ -46,6 +45,7 @@ int main(int argc, char* argv[]) {
     blueprint_t bp;
     dspbptk_coder_t coder;
     dspbptk_init_coder(&coder);
+    fprintf(stderr, "base64 = %s\n", dspbptk_base64_impl());
 
     // 蓝图解码
     uint64_t t_dec_0 = get_timestamp();
@@ -55,10 +55,14 @@ int main(int argc, char* argv[]) {
     if(errorlevel) {
         goto error;
     }
+    if(bp.md5f_status == md5f_mismatch)
+        fprintf(stderr, "Warning: MD5 abnormal!\n");
 
     // 蓝图编码
+    const size_t str_o_capacity = blueprint_encode_bound(&bp);
+    char* str_o = (char*)calloc(str_o_capacity, sizeof(char));
     uint64_t t_enc_0 = get_timestamp();
-    errorlevel = blueprint_encode(&coder, &bp, str_o);
+    errorlevel = blueprint_encode_opt(&coder, &bp, str_o, str_o_capacity, &dspbptk_encode_smallest);
     uint64_t t_enc_1 = get_timestamp();
     fprintf(stderr, "enc time = %.3lf ms\n", d_t(t_enc_1, t_enc_0));
     if(errorlevel) {
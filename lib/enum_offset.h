@@ -57,6 +57,52 @@ typedef enum {
     building_offset_parameters      = building_offset_num               + 2
 }building_offset_t;
 
+// 各字段在二进制流中的类型，X(name, type)，name与上面的偏移量一一对应
+
+#define BIN_HEAD_FIELDS(X)\
+    X(version,              i32_t)\
+    X(cursorOffset_x,       i32_t)\
+    X(cursorOffset_y,       i32_t)\
+    X(cursorTargetArea,     i32_t)\
+    X(dragBoxSize_x,        i32_t)\
+    X(dragBoxSize_y,        i32_t)\
+    X(primaryAreaIdx,       i32_t)
+
+#define AREA_FIELDS(X)\
+    X(index,                i8_t)\
+    X(parentIndex,          i8_t)\
+    X(tropicAnchor,         i16_t)\
+    X(areaSegments,         i16_t)\
+    X(anchorLocalOffsetX,   i16_t)\
+    X(anchorLocalOffsetY,   i16_t)\
+    X(width,                i16_t)\
+    X(height,               i16_t)
+
+#define BUILDING_FIELDS(X)\
+    X(index,                i32_t)\
+    X(areaIndex,            i8_t)\
+    X(localOffset_x,        f32_t)\
+    X(localOffset_y,        f32_t)\
+    X(localOffset_z,        f32_t)\
+    X(localOffset_x2,       f32_t)\
+    X(localOffset_y2,       f32_t)\
+    X(localOffset_z2,       f32_t)\
+    X(yaw,                  f32_t)\
+    X(yaw2,                 f32_t)\
+    X(itemId,               i16_t)\
+    X(modelIndex,           i16_t)\
+    X(tempOutputObjIdx,     i32_t)\
+    X(tempInputObjIdx,      i32_t)\
+    X(outputToSlot,         i8_t)\
+    X(inputFromSlot,        i8_t)\
+    X(outputFromSlot,       i8_t)\
+    X(inputToSlot,          i8_t)\
+    X(outputOffset,         i8_t)\
+    X(inputOffset,          i8_t)\
+    X(recipeId,             i16_t)\
+    X(filterId,             i16_t)\
+    X(num,                  i16_t)
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,6 +1,23 @@
 #include "libdspbptk.h"
 #include "enum_offset.h"
 
+#include <stddef.h>
+#include <stdatomic.h>
+
+#ifndef DSPBPTK_NO_THREAD
+#include <pthread.h>
+#endif
+
+#if defined(__linux__)
+#define DSPBPTK_MMAP
+#include <sys/mman.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DSPBPTK_X86_SIMD
+#include <immintrin.h>
+#endif
+
 ////////////////////////////////////////////////////////////////////////////////
 // 这些函数用于解耦dspbptk与底层库依赖，如果需要更换底层库时只要换掉这几个函数里就行
 ////////////////////////////////////////////////////////////////////////////////
@@ -29,6 +46,35 @@ size_t base64_dec(const char* in, size_t inlen, void* out) {
     return _tb64d((unsigned char*)in, inlen, (unsigned char*)out);
 }
 
+void base64_init(void) {
+    tb64ini(0, 0);
+}
+
+#ifndef DSPBPTK_NO_THREAD
+pthread_once_t base64_once = PTHREAD_ONCE_INIT;
+#endif
+
+/**
+ * @brief 检测CPU并选择最快的base64实现，每个进程只执行一次。用于解耦dspbptk与更底层的base64库
+ */
+void base64_select(void) {
+#ifndef DSPBPTK_NO_THREAD
+    pthread_once(&base64_once, base64_init);
+#else
+    base64_init();
+#endif
+}
+
+const char* dspbptk_base64_impl(void) {
+    if(_tb64e == tb64v256enc || _tb64e == _tb64v256enc)
+        return "avx2";
+    if(_tb64e == tb64v128aenc)
+        return "avx";
+    if(_tb64e == tb64v128enc)
+        return "ssse3";
+    return "scalar";
+}
+
 /**
  * @brief 返回base64解码后的准确长度。用于解耦dspbptk与更底层的base64库
  */
@@ -36,32 +82,70 @@ size_t base64_declen(const char* base64, size_t base64_length) {
     return tb64declen((unsigned char*)base64, base64_length);
 }
 
+/**
+ * @brief 返回coder中指定压缩等级的压缩器，第一次使用这个等级时才创建。用于解耦dspbptk与更底层的gzip库
+ *
+ * @param level 压缩等级，超出范围时按最近的有效等级处理
+ * @return struct libdeflate_compressor* 内存不足时返回NULL
+ */
+struct libdeflate_compressor* coder_compressor(dspbptk_coder_t* coder, int level) {
+    if(level < 0)
+        level = 0;
+    else if(level > COMPRESSION_LEVEL_MAX)
+        level = COMPRESSION_LEVEL_MAX;
+    if(coder->p_compressor[level] == NULL)
+        coder->p_compressor[level] = libdeflate_alloc_compressor(level);
+    return coder->p_compressor[level];
+}
+
+/**
+ * @brief 返回coder的解压器，第一次解码时才创建。用于解耦dspbptk与更底层的gzip库
+ *
+ * @return struct libdeflate_decompressor* 内存不足时返回NULL
+ */
+struct libdeflate_decompressor* coder_decompressor(dspbptk_coder_t* coder) {
+    if(coder->p_decompressor == NULL)
+        coder->p_decompressor = libdeflate_alloc_decompressor();
+    return coder->p_decompressor;
+}
+
 /**
  * @brief 通用的gzip压缩。用于解耦dspbptk与更底层的gzip库
  *
+ * @param compressor coder_compressor返回的压缩器
  * @param in 压缩前的二进制流
  * @param in_nbytes 压缩前的二进制流长度
  * @param out 压缩后的二进制流
- * @return size_t 压缩后的二进制流长度
+ * @param out_nbytes_avail out的容量，不小于gzip_bound(compressor, in_nbytes)时一定成功
+ * @return size_t 压缩后的二进制流长度，为0时表示out的空间不足
  */
-size_t gzip_enc(dspbptk_coder_t* coder, const unsigned char* in, size_t in_nbytes, unsigned char* out) {
+size_t gzip_enc(struct libdeflate_compressor* compressor, const unsigned char* in, size_t in_nbytes, unsigned char* out, size_t out_nbytes_avail) {
     size_t gzip_length = libdeflate_gzip_compress(
-        coder->p_compressor, in, in_nbytes, out, BLUEPRINT_MAX_LENGTH);
+        compressor, in, in_nbytes, out, out_nbytes_avail);
     return gzip_length;
 }
 
 /**
- * @brief 通用的gzip解压。用于解耦dspbptk与更底层的gzip库。假定out有足够的空间。
+ * @brief 返回gzip压缩后长度的上限。用于解耦dspbptk与更底层的gzip库
+ */
+size_t gzip_bound(struct libdeflate_compressor* compressor, size_t in_nbytes) {
+    return libdeflate_gzip_compress_bound(compressor, in_nbytes);
+}
+
+/**
+ * @brief 通用的gzip解压。用于解耦dspbptk与更底层的gzip库。
  *
+ * @param decompressor coder_decompressor返回的解压器
  * @param in 解压前的二进制流
  * @param in_nbytes 解压前的二进制流的长度
  * @param out 解压后的二进制流
+ * @param out_nbytes_avail out的容量
  * @return size_t 当返回值<=3时，表示解压错误；当返回值>=4时，表示解压成功并返回解压后的二进制流长度
  */
-size_t gzip_dec(dspbptk_coder_t* coder, const unsigned char* in, size_t in_nbytes, unsigned char* out) {
+size_t gzip_dec(struct libdeflate_decompressor* decompressor, const unsigned char* in, size_t in_nbytes, unsigned char* out, size_t out_nbytes_avail) {
     size_t actual_out_nbytes_ret;
     enum libdeflate_result result = libdeflate_gzip_decompress(
-        coder->p_decompressor, in, in_nbytes, out, BLUEPRINT_MAX_LENGTH, &actual_out_nbytes_ret);
+        decompressor, in, in_nbytes, out, out_nbytes_avail, &actual_out_nbytes_ret);
     if(result != LIBDEFLATE_SUCCESS)
         return (size_t)result;
     else
@@ -69,218 +153,990 @@ size_t gzip_dec(dspbptk_coder_t* coder, const unsigned char* in, size_t in_nbyte
 }
 
 /**
- * @brief 返回gzip解压后的准确长度。
+ * @brief 返回gzip解压后的准确长度，即gzip末尾记录的ISIZE。
  *
  * @param in 解压前的二进制流
  * @param in_nbytes 解压前的二进制流的长度
- * @return size_t 解压后的二进制流长度
+ * @return size_t 解压后的二进制流长度，in_nbytes不足4字节时返回0
  */
 size_t gzip_declen(const unsigned char* in, size_t in_nbytes) {
-    return (size_t) * ((uint32_t*)(in + in_nbytes - 4));
+    if(in_nbytes < 4)
+        return 0;
+    uint32_t isize;
+    memcpy(&isize, in + in_nbytes - 4, sizeof(uint32_t));
+    return (size_t)isize;
 }
 
 
 
 ////////////////////////////////////////////////////////////////////////////////
-// dspbptk decode
+// dspbptk allocator
 ////////////////////////////////////////////////////////////////////////////////
 
-dspbptk_error_t blueprint_decode(dspbptk_coder_t* coder, blueprint_t* blueprint, const char* string) {
-    // 初始化结构体，置零
-    memset(blueprint, 0, sizeof(blueprint_t));
+/**
+ * @brief 用allocator分配num * size字节并置零，语义同calloc
+ */
+void* dspbptk_calloc(const dspbptk_allocator_t* allocator, size_t num, size_t size) {
+    if(allocator->malloc_func == NULL)
+        return calloc(num, size);
+    if(size != 0 && num > SIZE_MAX / size)
+        return NULL;
+    const size_t length = num * size;
+    // 长度为0时也分配1字节，避免和内存不足混淆
+    void* ptr = allocator->malloc_func(allocator->opaque, length > 0 ? length : 1);
+    if(ptr != NULL)
+        memset(ptr, 0, length);
+    return ptr;
+}
+
+/**
+ * @brief 释放dspbptk_calloc分配的内存，语义同free
+ */
+void dspbptk_free(const dspbptk_allocator_t* allocator, void* ptr) {
+    if(allocator->malloc_func == NULL)
+        free(ptr);
+    else if(allocator->free_func != NULL && ptr != NULL)
+        allocator->free_func(allocator->opaque, ptr);
+}
 
-    // 获取输入的字符串的长度
-    const size_t string_length = strlen(string);
+// 缓冲区末尾多留的字节数，SIMD实现的base64解码可能写过有效数据的末尾
+#define CODER_BUFFER_PADDING 64
 
-    // 检查是不是蓝图
-#ifndef DSPBPTK_NO_ERROR
-    if(string_length < 10)
+/**
+ * @brief 用allocator分配size字节，不置零，语义同malloc
+ */
+void* dspbptk_malloc(const dspbptk_allocator_t* allocator, size_t size) {
+    if(allocator->malloc_func == NULL)
+        return malloc(size);
+    return allocator->malloc_func(allocator->opaque, size > 0 ? size : 1);
+}
+
+/**
+ * @brief 释放coder的一个缓冲区
+ *
+ * @param buffer &coder->buffer0或&coder->buffer1
+ * @param capacity buffer对应的容量
+ * @param mapped buffer是否由mmap分配
+ */
+void coder_buffer_free(dspbptk_coder_t* coder, void** buffer, size_t* capacity, int* mapped) {
+#ifdef DSPBPTK_MMAP
+    if(*mapped)
+        munmap(*buffer, *capacity);
+    else
+#endif
+        dspbptk_free(&coder->allocator, *buffer);
+    *buffer = NULL;
+    *capacity = 0;
+    *mapped = 0;
+}
+
+/**
+ * @brief 确保coder的一个缓冲区至少有length字节，不够时按2倍扩容，原有内容不保留。
+ * 缓冲区超过coder->buffer_shrink_threshold而这次用不到那么多时，释放后按需重新分配。
+ * 缓冲区里的每个字节在使用前都会被写入，所以分配时不置零
+ *
+ * @param which 0表示coder->buffer0，1表示coder->buffer1
+ * @param length 需要的字节数
+ * @return void* 缓冲区，内存不足时返回NULL
+ */
+void* coder_reserve(dspbptk_coder_t* coder, int which, size_t length) {
+    void** buffer = which == 0 ? &coder->buffer0 : &coder->buffer1;
+    size_t* capacity = which == 0 ? &coder->buffer0_capacity : &coder->buffer1_capacity;
+    int* mapped = which == 0 ? &coder->buffer0_mapped : &coder->buffer1_mapped;
+
+    if(length > SIZE_MAX - CODER_BUFFER_PADDING)
+        return NULL;
+    length += CODER_BUFFER_PADDING;
+    const size_t threshold = coder->buffer_shrink_threshold;
+    const int shrink = threshold > 0 && *capacity > threshold && length <= threshold;
+    if(*buffer != NULL && length <= *capacity && !shrink)
+        return *buffer;
+
+    size_t new_capacity = CODER_BUFFER_MIN_LENGTH;
+    if(!shrink && *capacity > new_capacity)
+        new_capacity = *capacity;
+    while(new_capacity < length)
+        new_capacity = new_capacity <= SIZE_MAX / 2 ? new_capacity * 2 : length;
+    // 不超过蓝图的长度上限太多，免得为一个接近上限的蓝图分配两倍的内存
+    if(new_capacity > BLUEPRINT_MAX_LENGTH && length <= BLUEPRINT_MAX_LENGTH)
+        new_capacity = BLUEPRINT_MAX_LENGTH;
+    else if(new_capacity > BLUEPRINT_MAX_LENGTH)
+        new_capacity = length;
+    DBG(new_capacity);
+
+    coder_buffer_free(coder, buffer, capacity, mapped);
+#ifdef DSPBPTK_MMAP
+    // 大缓冲区直接向内核要，MAP_NORESERVE不预留交换空间，页面在第一次写入时才分配，
+    // 内核给的页面本来就是零，不用再逐页置零；MADV_HUGEPAGE让解压、解析时少一些TLB未命中
+    if(coder->buffer_huge_page && new_capacity >= HUGE_PAGE_LENGTH) {
+        new_capacity = (new_capacity + HUGE_PAGE_LENGTH - 1) / HUGE_PAGE_LENGTH * HUGE_PAGE_LENGTH;
+        void* ptr = mmap(NULL, new_capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if(ptr != MAP_FAILED) {
+        #ifdef MADV_HUGEPAGE
+            madvise(ptr, new_capacity, MADV_HUGEPAGE);
+        #endif
+            *buffer = ptr;
+            *capacity = new_capacity;
+            *mapped = 1;
+            return *buffer;
+        }
+        // mmap失败时退回到allocator
+    }
+#endif
+    *buffer = dspbptk_malloc(&coder->allocator, new_capacity);
+    *capacity = *buffer != NULL ? new_capacity : 0;
+    return *buffer;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// dspbptk head
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief 解析一个十进制整数，允许负号。不依赖locale，也不会越过end
+ *
+ * @return const char* 成功时返回整数之后的位置；失败时返回NULL
+ */
+const char* parse_i64(const char* ptr, const char* end, i64_t* value) {
+    int negative = 0;
+    if(ptr < end && *ptr == '-') {
+        negative = 1;
+        ptr++;
+    }
+    const char* digits = ptr;
+    uint64_t tmp = 0;
+    while(ptr < end && (unsigned)(*ptr - '0') < 10u) {
+        tmp = tmp * 10 + (uint64_t)(*ptr - '0');
+        ptr++;
+    }
+    if(ptr == digits)
+        return NULL;
+    *value = negative ? -(i64_t)tmp : (i64_t)tmp;
+    return ptr;
+}
+
+/**
+ * @brief 按"BLUEPRINT:0,layout,icons*5,0,time,gameVersion.*4,shortDesc"的格式解析head
+ *
+ * @param head 解析后的head
+ * @param ptr head的起始位置
+ * @param end head的结束位置，解析不会越过此处
+ * @return const char* 成功时返回结束head的双引号的位置；失败时返回NULL
+ */
+const char* parse_head(blueprint_head_t* head, const char* ptr, const char* end) {
+#define EXPECT_CHAR(c)\
+    {if(ptr == NULL || ptr >= end || *ptr != (c)) return NULL; ptr++;}
+#define EXPECT_I64(x, c)\
+    {ptr = parse_i64(ptr, end, (x)); EXPECT_CHAR(c);}
+
+    if(end - ptr < 10 || memcmp(ptr, "BLUEPRINT:", 10) != 0)
+        return NULL;
+    ptr += 10;
+    EXPECT_CHAR('0');
+    EXPECT_CHAR(',');
+    EXPECT_I64(&head->layout, ',');
+    for(int i = 0; i < 5; i++)
+        EXPECT_I64(&head->icons[i], ',');
+    EXPECT_CHAR('0');
+    EXPECT_CHAR(',');
+    EXPECT_I64(&head->time, ',');
+    EXPECT_I64(&head->gameVersion[0], '.');
+    EXPECT_I64(&head->gameVersion[1], '.');
+    EXPECT_I64(&head->gameVersion[2], '.');
+    EXPECT_I64(&head->gameVersion[3], ',');
+
+    const char* quote = memchr(ptr, '\"', (size_t)(end - ptr));
+    if(quote == NULL)
+        return NULL;
+    head->shortDesc = ptr;
+    head->shortDesc_length = (size_t)(quote - ptr);
+    return quote;
+
+#undef EXPECT_I64
+#undef EXPECT_CHAR
+}
+
+dspbptk_error_t blueprint_peek_header(blueprint_head_t* head, const char* string) {
+    memset(head, 0, sizeof(blueprint_head_t));
+
+    // head的长度有上限，只看字符串开头的一小段，不对整个蓝图做strlen
+    const char* end = string + strnlen(string, HEAD_MAX_LENGTH + 1);
+    if(end - string < 10 || memcmp(string, "BLUEPRINT:", 10) != 0)
         return not_blueprint;
-    if(memcmp(string, "BLUEPRINT:", 10) != 0)
+    if(parse_head(head, string, end) == NULL)
+        return blueprint_head_broken;
+
+    return no_error;
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// dspbptk id map
+////////////////////////////////////////////////////////////////////////////////
+
+// 从建筑的index到位置的映射。编码时用来重排index，筛选解码时用来检查index是否还在蓝图中。
+// index连续时(解码得到的蓝图通常如此)直接查表，否则用开放寻址的散列表
+typedef struct {
+    int dense;
+    i64_t min_id;       // 直接查表时表中第一项对应的index
+    size_t length;      // 表的长度，散列时是2的幂
+    i64_t* id;          // 散列时每一项的index，直接查表时不使用
+    i32_t* position;    // 每一项对应的输出位置，为OBJ_NULL时表示空
+}id_map_t;
+
+/**
+ * @brief 根据index的范围选择映射方式
+ *
+ * @param min_id 所有建筑中最小的index
+ * @param max_id 所有建筑中最大的index
+ * @param BUILDING_NUM 建筑数量
+ * @return size_t 映射表需要的字节数
+ */
+size_t id_map_init(id_map_t* map, i64_t min_id, i64_t max_id, size_t BUILDING_NUM) {
+    map->min_id = min_id;
+    // 查表比散列表多用的空间不超过几倍时直接查表
+    const uint64_t span = (uint64_t)max_id - (uint64_t)min_id;
+    map->dense = BUILDING_NUM == 0 || span < (uint64_t)BUILDING_NUM * 4 + 64;
+    if(map->dense) {
+        map->length = BUILDING_NUM == 0 ? 0 : (size_t)span + 1;
+        return map->length * sizeof(i32_t);
+    }
+    map->length = 16;
+    while(map->length < BUILDING_NUM * 2)
+        map->length *= 2;
+    return map->length * (sizeof(i64_t) + sizeof(i32_t));
+}
+
+/**
+ * @brief 把映射表放到memory上并清空
+ *
+ * @param memory 至少id_map_init返回的字节数，按8字节对齐
+ */
+void id_map_attach(id_map_t* map, void* memory) {
+    if(map->dense) {
+        map->id = NULL;
+        map->position = (i32_t*)memory;
+    }
+    else {
+        map->id = (i64_t*)memory;
+        map->position = (i32_t*)(map->id + map->length);
+    }
+    memset(map->position, 0xff, map->length * sizeof(i32_t)); // 全部置为OBJ_NULL
+}
+
+/**
+ * @brief 散列表中index所在或应该插入的位置
+ */
+static inline size_t id_map_slot(const id_map_t* map, i64_t id) {
+    size_t slot = (size_t)(((uint64_t)id * UINT64_C(0x9E3779B97F4A7C15)) >> 32) & (map->length - 1);
+    while(map->position[slot] != OBJ_NULL && map->id[slot] != id)
+        slot = (slot + 1) & (map->length - 1);
+    return slot;
+}
+
+/**
+ * @brief 记录index为id的建筑在position。index重复时以第一个为准
+ */
+static inline void id_map_insert(id_map_t* map, i64_t id, size_t position) {
+    const size_t slot = map->dense ? (size_t)((uint64_t)id - (uint64_t)map->min_id) : id_map_slot(map, id);
+    if(map->position[slot] == OBJ_NULL) {
+        if(!map->dense)
+            map->id[slot] = id;
+        map->position[slot] = (i32_t)position;
+    }
+}
+
+/**
+ * @brief 查找index为id的建筑的位置
+ *
+ * @return i32_t 没有这个index时返回OBJ_NULL
+ */
+static inline i32_t id_map_find(const id_map_t* map, i64_t id) {
+    if(map->dense) {
+        const uint64_t slot = (uint64_t)id - (uint64_t)map->min_id;
+        return slot < map->length ? map->position[slot] : OBJ_NULL;
+    }
+    return map->position[id_map_slot(map, id)];
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// dspbptk decode
+////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * @brief 检查是不是蓝图，解析head，并根据双引号标记出base64和md5f的位置
+ *
+ * @param string 蓝图字符串
+ * @param string_length 蓝图字符串长度
+ * @param head 解析后的head
+ * @param base64 base64部分的起始位置
+ * @param md5f md5f的起始位置，base64部分到md5f前的双引号为止
+ * @return dspbptk_error_t 错误代码
+ */
+dspbptk_error_t split_string(const char* string, size_t string_length, blueprint_head_t* head, const char** base64, const char** md5f) {
+    if(string_length < 10 || memcmp(string, "BLUEPRINT:", 10) != 0)
         return not_blueprint;
+    const char* quote = parse_head(head, string, string + string_length);
+    if(quote == NULL)
+        return blueprint_head_broken;
+    *base64 = quote + 1;
+    *md5f = string + string_length - MD5F_LENGTH;
+    if(*md5f <= *base64 || *(*md5f - 1) != '\"')
+        return blueprint_md5f_broken;
+    return no_error;
+}
+
+#ifndef DSPBPTK_NO_THREAD
+typedef struct {
+    const char* string;
+    size_t string_length;
+    char md5f_check[MD5F_LENGTH + 1];
+}md5f_task_t;
+
+void* md5f_thread(void* arg) {
+    md5f_task_t* task = (md5f_task_t*)arg;
+    md5f_ctx_t md5f_ctx;
+    md5f_init(&md5f_ctx);
+    md5f_update(&md5f_ctx, task->string, task->string_length);
+    md5f_final_str(&md5f_ctx, task->md5f_check);
+    return NULL;
+}
+#endif
+
+/**
+ * @brief 校验md5f，并依次进行base64解码、gzip解压，得到蓝图的二进制流
+ *
+ * @param string 蓝图字符串
+ * @param base64 base64部分的起始位置，head的长度由此得出
+ * @param base64_length base64部分的长度
+ * @param md5f 蓝图字符串中md5f的起始位置
+ * @param bin 解压后的二进制流，位于coder->buffer1中，下次使用coder前有效
+ * @param bin_length 解压后的二进制流长度
+ * @param md5f_status md5f的校验结果，校验方式由coder->md5f_verify决定
+ * @return dspbptk_error_t 错误代码
+ */
+dspbptk_error_t decode_payload(dspbptk_coder_t* coder, const char* string,
+    const char* base64, size_t base64_length, const char* md5f, void** bin, size_t* bin_length, md5f_status_t* md5f_status) {
+    md5f_verify_t md5f_verify = coder->md5f_verify;
+    char md5f_check[MD5F_LENGTH + 1] = "\0";
+    md5f_ctx_t md5f_ctx;
+    md5f_init(&md5f_ctx);
+    *md5f_status = md5f_unchecked;
+
+    // md5f覆盖head和base64两部分
+    const size_t md5f_stream_length = (size_t)(base64 - string) + base64_length;
+    if(md5f_verify == md5f_verify_sync) {
+        // 先完整计算一遍
+        md5f_update(&md5f_ctx, string, md5f_stream_length);
+        md5f_final_str(&md5f_ctx, md5f_check);
+    }
+#ifndef DSPBPTK_NO_THREAD
+    // 在辅助线程中计算，和base64解码、gzip解压同时进行
+    pthread_t md5f_thread_id;
+    md5f_task_t md5f_task;
+    if(md5f_verify == md5f_verify_thread) {
+        md5f_task.string = string;
+        md5f_task.string_length = md5f_stream_length;
+        // 线程创建失败时退回到按块交替计算
+        if(pthread_create(&md5f_thread_id, NULL, md5f_thread, &md5f_task) != 0)
+            md5f_verify = md5f_verify_interleaved;
+    }
+#else
+    if(md5f_verify == md5f_verify_thread)
+        md5f_verify = md5f_verify_interleaved;
 #endif
+    if(md5f_verify == md5f_verify_interleaved)
+        md5f_update(&md5f_ctx, string, (size_t)(base64 - string));
 
-    // 根据双引号标记字符串
-    const char* head = string;
-    const char* base64 = strchr(string, (int)'\"') + 1;
-    const char* md5f = string + string_length - MD5F_LENGTH;
+    // base64解码
+    // 按块处理：交替计算md5f时每块先算md5f再解码，块足够小能留在L2缓存里，
+    // 这样整个字符串只从内存读一次，不再为md5f单独拷贝、遍历一遍
+    // 缓冲区按base64解码后的准确长度准备
+    const size_t gzip_capacity = base64_declen(base64, base64_length);
+    dspbptk_error_t errorlevel = no_error;
+    if(gzip_capacity == 0)
+        errorlevel = blueprint_base64_broken;
+    void* gzip = coder_reserve(coder, 0, gzip_capacity);
+    if(gzip == NULL)
+        errorlevel = out_of_memory;
+    size_t gzip_length = 0;
+    for(size_t offset = 0; offset < base64_length && errorlevel == no_error; offset += BASE64_CHUNK_LENGTH) {
+        const size_t chunk_length = base64_length - offset < BASE64_CHUNK_LENGTH ?
+            base64_length - offset : BASE64_CHUNK_LENGTH;
+        if(md5f_verify == md5f_verify_interleaved)
+            md5f_update(&md5f_ctx, base64 + offset, chunk_length);
+        const size_t chunk_gzip_length = base64_dec(base64 + offset, chunk_length, gzip + gzip_length);
+    #ifndef DSPBPTK_NO_ERROR
+        if(chunk_gzip_length <= 0)
+            errorlevel = blueprint_base64_broken;
+    #endif
+        gzip_length += chunk_gzip_length;
+    }
+    DBG(gzip_length);
+    if(md5f_verify == md5f_verify_interleaved)
+        md5f_final_str(&md5f_ctx, md5f_check);
+
+    // gzip解压
+    // 缓冲区按gzip末尾记录的解压后长度准备，超过上限的一定不是正常的蓝图
+    size_t bin_capacity = 0;
+    if(errorlevel == no_error) {
+        bin_capacity = gzip_declen(gzip, gzip_length);
+        if(bin_capacity == 0 || bin_capacity > BLUEPRINT_MAX_LENGTH)
+            errorlevel = blueprint_gzip_broken;
+    }
+    struct libdeflate_decompressor* decompressor = NULL;
+    if(errorlevel == no_error) {
+        *bin = coder_reserve(coder, 1, bin_capacity);
+        decompressor = coder_decompressor(coder);
+        if(*bin == NULL || decompressor == NULL)
+            errorlevel = out_of_memory;
+    }
+    if(errorlevel == no_error) {
+        *bin_length = gzip_dec(decompressor, gzip, gzip_length, *bin, bin_capacity);
+        DBG(*bin_length);
+    #ifndef DSPBP_NO_CHECK
+        if(*bin_length <= 3)
+            errorlevel = blueprint_gzip_broken;
+    #endif
+    }
+
+#ifndef DSPBPTK_NO_THREAD
+    if(md5f_verify == md5f_verify_thread) {
+        pthread_join(md5f_thread_id, NULL);
+        memcpy(md5f_check, md5f_task.md5f_check, sizeof(md5f_check));
+    }
+#endif
+    if(md5f_verify != md5f_verify_off)
+        *md5f_status = memcmp(md5f, md5f_check, MD5F_LENGTH) == 0 ? md5f_ok : md5f_mismatch;
+
+    return errorlevel;
+}
+
+/**
+ * @brief 扫描建筑数组，只读取每个建筑的参数数量，得到每个建筑记录的偏移量
+ *
+ * @param bin 二进制流
+ * @param bin_length 二进制流长度
+ * @param offset 建筑数组相对于bin的偏移量
+ * @param BUILDING_NUM 建筑数量
+ * @param building_offset 每个建筑记录相对于bin的偏移量，可以为NULL
+ * @param parameters_num 所有建筑的参数总数，可以为NULL
+ * @return dspbptk_error_t 记录越过二进制流末尾时返回blueprint_data_broken
+ */
+dspbptk_error_t scan_building(const void* bin, size_t bin_length, size_t offset, size_t BUILDING_NUM, uint32_t* building_offset, size_t* parameters_num) {
+    size_t PARAMETERS_NUM_ALL = 0;
+    for(size_t i = 0; i < BUILDING_NUM; i++) {
+    #ifndef DSPBPTK_NO_ERROR
+        if(offset + building_offset_parameters > bin_length)
+            return blueprint_data_broken;
+    #endif
+        if(building_offset != NULL)
+            building_offset[i] = (uint32_t)offset;
+        const size_t PARAMETERS_NUM = (size_t)(uint16_t) * ((i16_t*)(bin + offset + building_offset_num));
+        PARAMETERS_NUM_ALL += PARAMETERS_NUM;
+        offset += building_offset_parameters + PARAMETERS_NUM * sizeof(i32_t);
+    }
 #ifndef DSPBPTK_NO_ERROR
-    if(*(md5f - 1) != '\"')
-        return blueprint_md5f_broken;
+    if(offset > bin_length)
+        return blueprint_data_broken;
+#endif
+    if(parameters_num != NULL)
+        *parameters_num = PARAMETERS_NUM_ALL;
+    return no_error;
+}
+
+#ifndef DSPBPTK_COMPACT_BUILDING
+/**
+ * @brief 展开一个建筑记录定长部分中的整数字段
+ *
+ * @param building 展开后的建筑
+ * @param ptr_bin 建筑记录的起始位置
+ */
+static inline void unpack_building_integer(building_t* building, const void* ptr_bin) {
+#define BUILDING_UNPACK(name, type)\
+    building->name = *((type*)(ptr_bin + building_offset_##name));
+    BUILDING_UNPACK(index, i32_t);
+    BUILDING_UNPACK(areaIndex, i8_t);
+    BUILDING_UNPACK(itemId, i16_t);
+    BUILDING_UNPACK(modelIndex, i16_t);
+    BUILDING_UNPACK(tempOutputObjIdx, i32_t);
+    BUILDING_UNPACK(tempInputObjIdx, i32_t);
+    BUILDING_UNPACK(outputToSlot, i8_t);
+    BUILDING_UNPACK(inputFromSlot, i8_t);
+    BUILDING_UNPACK(outputFromSlot, i8_t);
+    BUILDING_UNPACK(inputToSlot, i8_t);
+    BUILDING_UNPACK(outputOffset, i8_t);
+    BUILDING_UNPACK(inputOffset, i8_t);
+    BUILDING_UNPACK(recipeId, i16_t);
+    BUILDING_UNPACK(filterId, i16_t);
+#undef BUILDING_UNPACK
+    building->num = (size_t)(uint16_t) * ((i16_t*)(ptr_bin + building_offset_num));
+}
+
+/**
+ * @brief 展开一个建筑记录的定长部分(不含参数列表)。标量版本，所有平台可用
+ *
+ * @param building 展开后的建筑
+ * @param ptr_bin 建筑记录的起始位置
+ */
+void unpack_building_scalar(building_t* building, const void* ptr_bin) {
+    unpack_building_integer(building, ptr_bin);
+    // 把建筑坐标转换成齐次坐标
+    building->localOffset.x = (f64_t) * ((f32_t*)(ptr_bin + building_offset_localOffset_x));
+    building->localOffset.y = (f64_t) * ((f32_t*)(ptr_bin + building_offset_localOffset_y));
+    building->localOffset.z = (f64_t) * ((f32_t*)(ptr_bin + building_offset_localOffset_z));
+    building->localOffset.w = (f64_t)1.0;
+    building->localOffset2.x = (f64_t) * ((f32_t*)(ptr_bin + building_offset_localOffset_x2));
+    building->localOffset2.y = (f64_t) * ((f32_t*)(ptr_bin + building_offset_localOffset_y2));
+    building->localOffset2.z = (f64_t) * ((f32_t*)(ptr_bin + building_offset_localOffset_z2));
+    building->localOffset2.w = (f64_t)1.0;
+    building->yaw = (f64_t) * ((f32_t*)(ptr_bin + building_offset_yaw));
+    building->yaw2 = (f64_t) * ((f32_t*)(ptr_bin + building_offset_yaw2));
+}
+
+#ifdef DSPBPTK_X86_SIMD
+// 记录中的字段和building_t的成员都是连续的几段，每段用一次符号扩展/类型转换整体写入。
+// building_t的布局变了的话这里必须同步修改
+_Static_assert(offsetof(building_t, modelIndex) == offsetof(building_t, itemId) + 8 &&
+    offsetof(building_t, tempOutputObjIdx) == offsetof(building_t, itemId) + 16 &&
+    offsetof(building_t, tempInputObjIdx) == offsetof(building_t, itemId) + 24 &&
+    offsetof(building_t, inputOffset) == offsetof(building_t, outputToSlot) + 40 &&
+    offsetof(building_t, filterId) == offsetof(building_t, recipeId) + 8 &&
+    offsetof(building_t, yaw2) == offsetof(building_t, yaw) + 8,
+    "building_t layout does not match unpack_building_avx2");
+
+/**
+ * @brief 展开一个建筑记录的定长部分。SSE2版本，坐标两个一组用cvtps2pd转换，整数字段仍是标量
+ */
+__attribute__((target("sse2")))
+void unpack_building_sse2(building_t* building, const void* ptr_bin) {
+    unpack_building_integer(building, ptr_bin);
+    const __m128d one = _mm_set_sd(1.0);
+#define LOAD_F32X2(offset) _mm_castpd_ps(_mm_load_sd((const double*)(ptr_bin + (offset))))
+    _mm_storeu_pd(&building->localOffset.x, _mm_cvtps_pd(LOAD_F32X2(building_offset_localOffset_x)));
+    _mm_storeu_pd(&building->localOffset.z, _mm_unpacklo_pd(_mm_cvtps_pd(_mm_load_ss((const float*)(ptr_bin + building_offset_localOffset_z))), one));
+    _mm_storeu_pd(&building->localOffset2.x, _mm_cvtps_pd(LOAD_F32X2(building_offset_localOffset_x2)));
+    _mm_storeu_pd(&building->localOffset2.z, _mm_unpacklo_pd(_mm_cvtps_pd(_mm_load_ss((const float*)(ptr_bin + building_offset_localOffset_z2))), one));
+    _mm_storeu_pd(&building->yaw, _mm_cvtps_pd(LOAD_F32X2(building_offset_yaw)));
+#undef LOAD_F32X2
+}
+
+/**
+ * @brief 展开一个建筑记录的定长部分。AVX2版本，整数字段用vpmovsx一次符号扩展一段，坐标用vcvtps2pd
+ */
+__attribute__((target("avx2")))
+void unpack_building_avx2(building_t* building, const void* ptr_bin) {
+    const __m256d one = _mm256_set1_pd(1.0);
+    i32_t tmp32;
+    i16_t tmp16;
+
+    building->index = *((i32_t*)(ptr_bin + building_offset_index));
+    building->areaIndex = *((i8_t*)(ptr_bin + building_offset_areaIndex));
+
+    // z x2 y2 z2 -> x2 y2 z2 1.0
+    const __m256d xyzx2 = _mm256_cvtps_pd(_mm_loadu_ps((const float*)(ptr_bin + building_offset_localOffset_x)));
+    const __m256d zx2y2z2 = _mm256_cvtps_pd(_mm_loadu_ps((const float*)(ptr_bin + building_offset_localOffset_z)));
+    _mm256_storeu_pd(&building->localOffset.x, _mm256_blend_pd(xyzx2, one, 0x8));
+    _mm256_storeu_pd(&building->localOffset2.x, _mm256_blend_pd(_mm256_permute4x64_pd(zx2y2z2, _MM_SHUFFLE(0, 3, 2, 1)), one, 0x8));
+    _mm_storeu_pd(&building->yaw, _mm_cvtps_pd(_mm_castpd_ps(_mm_load_sd((const double*)(ptr_bin + building_offset_yaw)))));
+
+    // itemId modelIndex(i16) + tempOutputObjIdx tempInputObjIdx(i32)
+    memcpy(&tmp32, ptr_bin + building_offset_itemId, sizeof(i32_t));
+    _mm_storeu_si128((__m128i*)&building->itemId, _mm_cvtepi16_epi64(_mm_cvtsi32_si128(tmp32)));
+    _mm_storeu_si128((__m128i*)&building->tempOutputObjIdx, _mm_cvtepi32_epi64(_mm_loadl_epi64((const __m128i*)(ptr_bin + building_offset_tempOutputObjIdx))));
+
+    // 6个i8的slot/offset
+    memcpy(&tmp32, ptr_bin + building_offset_outputToSlot, sizeof(i32_t));
+    _mm256_storeu_si256((__m256i*)&building->outputToSlot, _mm256_cvtepi8_epi64(_mm_cvtsi32_si128(tmp32)));
+    memcpy(&tmp16, ptr_bin + building_offset_outputOffset, sizeof(i16_t));
+    _mm_storeu_si128((__m128i*)&building->outputOffset, _mm_cvtepi8_epi64(_mm_cvtsi32_si128((uint16_t)tmp16)));
+
+    // recipeId filterId(i16)，num无符号
+    memcpy(&tmp32, ptr_bin + building_offset_recipeId, sizeof(i32_t));
+    _mm_storeu_si128((__m128i*)&building->recipeId, _mm_cvtepi16_epi64(_mm_cvtsi32_si128(tmp32)));
+    building->num = (size_t)(uint16_t) * ((i16_t*)(ptr_bin + building_offset_num));
+}
+#endif
+
+/**
+ * @brief 选择当前CPU可用的最快的unpack_building实现
+ */
+void (*select_unpack_building(void))(building_t*, const void*) {
+#ifdef DSPBPTK_X86_SIMD
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        return unpack_building_avx2;
+    if(__builtin_cpu_supports("sse2"))
+        return unpack_building_sse2;
+#endif
+    return unpack_building_scalar;
+}
+
+// 当前CPU上使用的unpack_building实现，由unpack_building_select在初始化coder时选定
+void (*unpack_building)(building_t*, const void*) = unpack_building_scalar;
+
+void unpack_building_init(void) {
+    unpack_building = select_unpack_building();
+}
+
+#ifndef DSPBPTK_NO_THREAD
+pthread_once_t unpack_building_once = PTHREAD_ONCE_INIT;
+#endif
+
+/**
+ * @brief 检测CPU并选择最快的unpack_building实现，每个进程只执行一次
+ */
+void unpack_building_select(void) {
+#ifndef DSPBPTK_NO_THREAD
+    pthread_once(&unpack_building_once, unpack_building_init);
+#else
+    unpack_building_init();
+#endif
+}
 #endif
-    const size_t head_length = (size_t)(base64 - head - 1);
+
+/**
+ * @brief 判断一个建筑记录是否符合filter的条件
+ *
+ * @param filter 筛选条件
+ * @param ptr_building 建筑记录的起始位置
+ * @return int 符合条件时返回1，否则返回0
+ */
+int filter_building(const dspbptk_filter_t* filter, const void* ptr_building) {
+    if(filter->itemId != NULL) {
+        const i16_t itemId = *((i16_t*)(ptr_building + building_offset_itemId));
+        size_t j = 0;
+        while(j < filter->itemId_num && filter->itemId[j] != itemId)
+            j++;
+        if(j == filter->itemId_num)
+            return 0;
+    }
+    if(filter->areaIndex != NULL) {
+        const i8_t areaIndex = *((i8_t*)(ptr_building + building_offset_areaIndex));
+        size_t j = 0;
+        while(j < filter->areaIndex_num && filter->areaIndex[j] != areaIndex)
+            j++;
+        if(j == filter->areaIndex_num)
+            return 0;
+    }
+    if(filter->callback != NULL && !filter->callback(filter->opaque, ptr_building))
+        return 0;
+    return 1;
+}
+
+/**
+ * @brief 把指向不在蓝图中的建筑的tempOutputObjIdx/tempInputObjIdx改为OBJ_NULL。映射表放在coder的buffer0中
+ *
+ * @param blueprint 筛选后的蓝图
+ * @return dspbptk_error_t 错误代码
+ */
+dspbptk_error_t drop_dangling_index(dspbptk_coder_t* coder, blueprint_t* blueprint) {
+    const size_t BUILDING_NUM = blueprint->BUILDING_NUM;
+    i64_t min_id = BUILDING_NUM > 0 ? blueprint->building[0].index : 0;
+    i64_t max_id = min_id;
+    for(size_t i = 1; i < BUILDING_NUM; i++) {
+        const i64_t id = blueprint->building[i].index;
+        min_id = id < min_id ? id : min_id;
+        max_id = id > max_id ? id : max_id;
+    }
+    id_map_t id_map;
+    void* id_map_memory = coder_reserve(coder, 0, id_map_init(&id_map, min_id, max_id, BUILDING_NUM));
+    if(id_map_memory == NULL)
+        return out_of_memory;
+    id_map_attach(&id_map, id_map_memory);
+    for(size_t i = 0; i < BUILDING_NUM; i++)
+        id_map_insert(&id_map, blueprint->building[i].index, i);
+#define DROP_DANGLING_INDEX(name)\
+    {\
+        const i64_t ObjIdx = blueprint->building[i].name;\
+        if(ObjIdx != OBJ_NULL && id_map_find(&id_map, ObjIdx) == OBJ_NULL)\
+            blueprint->building[i].name = OBJ_NULL;\
+    }
+    for(size_t i = 0; i < BUILDING_NUM; i++) {
+        DROP_DANGLING_INDEX(tempOutputObjIdx);
+        DROP_DANGLING_INDEX(tempInputObjIdx);
+    }
+#undef DROP_DANGLING_INDEX
+    return no_error;
+}
+
+/**
+ * @brief 解析建筑数组中[begin, end)范围内的建筑。不同的范围互不影响，可以在多个线程中同时调用
+ *
+ * @param blueprint 已经分配好building和parameters_memory的蓝图
+ * @param bin 二进制流
+ * @param building_offset 要解析的每个建筑记录的偏移量
+ * @param begin 起始建筑
+ * @param end 结束建筑(不含)
+ * @param parameters_offset 第begin个建筑的参数列表在parameters_memory中的位置
+ */
+void decode_building(blueprint_t* blueprint, const void* bin, const uint32_t* building_offset, size_t begin, size_t end, size_t parameters_offset) {
+    for(size_t i = begin; i < end; i++) {
+        const void* ptr_bin = bin + building_offset[i];
+    #ifndef DSPBPTK_COMPACT_BUILDING
+        unpack_building(&blueprint->building[i], ptr_bin);
+    #else
+    #define BUILDING_DECODE(name, type)\
+        blueprint->building[i].name = *((type*)(ptr_bin + building_offset_##name));
+        BUILDING_DECODE(index, i32_t);
+        BUILDING_DECODE(areaIndex, i8_t);
+        // 坐标在二进制流中是连续的，直接复制
+        memcpy(&blueprint->building[i].localOffset, ptr_bin + building_offset_localOffset_x, sizeof(f32x3_t));
+        memcpy(&blueprint->building[i].localOffset2, ptr_bin + building_offset_localOffset_x2, sizeof(f32x3_t));
+        memcpy(&blueprint->building[i].yaw, ptr_bin + building_offset_yaw, sizeof(f32_t));
+        memcpy(&blueprint->building[i].yaw2, ptr_bin + building_offset_yaw2, sizeof(f32_t));
+        BUILDING_DECODE(itemId, i16_t);
+        BUILDING_DECODE(modelIndex, i16_t);
+        BUILDING_DECODE(tempOutputObjIdx, i32_t);
+        BUILDING_DECODE(tempInputObjIdx, i32_t);
+        BUILDING_DECODE(outputToSlot, i8_t);
+        BUILDING_DECODE(inputFromSlot, i8_t);
+        BUILDING_DECODE(outputFromSlot, i8_t);
+        BUILDING_DECODE(inputToSlot, i8_t);
+        BUILDING_DECODE(outputOffset, i8_t);
+        BUILDING_DECODE(inputOffset, i8_t);
+        BUILDING_DECODE(recipeId, i16_t);
+        BUILDING_DECODE(filterId, i16_t);
+        BUILDING_DECODE(num, i16_t);
+    #undef BUILDING_DECODE
+    #endif
+
+        // DBG(blueprint->building[i].itemId);
+
+        // 解析建筑的参数列表，参数列表位于parameters_memory中
+        const size_t PARAMETERS_NUM = (size_t)(uint16_t)blueprint->building[i].num;
+        if(PARAMETERS_NUM > 0) {
+            blueprint->building[i].parameters = (void*)((char*)blueprint->parameters_memory + parameters_offset * sizeof(*blueprint->building[i].parameters));
+            parameters_offset += PARAMETERS_NUM;
+        }
+        else {
+            blueprint->building[i].parameters = NULL;
+        }
+        ptr_bin += building_offset_parameters;
+    #ifndef DSPBPTK_COMPACT_BUILDING
+        for(size_t j = 0; j < PARAMETERS_NUM; j++)
+            blueprint->building[i].parameters[j] = (i64_t) * ((i32_t*)(ptr_bin + j * sizeof(i32_t)));
+    #else
+        // 没有参数的建筑parameters为NULL，即使长度为0也不能传给memcpy
+        if(PARAMETERS_NUM > 0)
+            memcpy(blueprint->building[i].parameters, ptr_bin, PARAMETERS_NUM * sizeof(i32_t));
+    #endif
+    }
+}
+
+#ifndef DSPBPTK_NO_THREAD
+typedef struct {
+    blueprint_t* blueprint;
+    const void* bin;
+    const uint32_t* building_offset;
+    size_t begin;
+    size_t end;
+    size_t parameters_offset;
+}decode_building_task_t;
+
+void* decode_building_thread(void* arg) {
+    decode_building_task_t* task = (decode_building_task_t*)arg;
+    decode_building(task->blueprint, task->bin, task->building_offset, task->begin, task->end, task->parameters_offset);
+    return NULL;
+}
+#endif
+
+/**
+ * @brief 把建筑数组均分成thread_num段，每段由一个线程解析。当前线程解析最后一段
+ *
+ * @param thread_num 线程数，0或1时在当前线程中解析全部建筑
+ */
+void decode_building_parallel(blueprint_t* blueprint, const void* bin, const uint32_t* building_offset, size_t BUILDING_NUM, size_t thread_num) {
+#ifndef DSPBPTK_NO_THREAD
+    if(thread_num > THREAD_MAX_NUM)
+        thread_num = THREAD_MAX_NUM;
+    if(thread_num > 1) {
+        pthread_t thread[THREAD_MAX_NUM];
+        int thread_created[THREAD_MAX_NUM];
+        decode_building_task_t task[THREAD_MAX_NUM];
+        // 每段的参数列表的起始位置要数出前面所有建筑的参数数量
+        size_t parameters_offset = 0;
+        for(size_t t = 0; t < thread_num; t++) {
+            task[t].blueprint = blueprint;
+            task[t].bin = bin;
+            task[t].building_offset = building_offset;
+            task[t].begin = BUILDING_NUM * t / thread_num;
+            task[t].end = BUILDING_NUM * (t + 1) / thread_num;
+            task[t].parameters_offset = parameters_offset;
+            for(size_t i = task[t].begin; i < task[t].end; i++)
+                parameters_offset += (size_t)(uint16_t) * ((i16_t*)(bin + building_offset[i] + building_offset_num));
+        }
+        for(size_t t = 0; t + 1 < thread_num; t++) {
+            // 线程创建失败时在当前线程里补上这一段
+            thread_created[t] = pthread_create(&thread[t], NULL, decode_building_thread, &task[t]) == 0;
+            if(!thread_created[t])
+                decode_building_thread(&task[t]);
+        }
+        decode_building_thread(&task[thread_num - 1]);
+        for(size_t t = 0; t + 1 < thread_num; t++) {
+            if(thread_created[t])
+                pthread_join(thread[t], NULL);
+        }
+        return;
+    }
+#endif
+    decode_building(blueprint, bin, building_offset, 0, BUILDING_NUM, 0);
+}
+
+dspbptk_error_t blueprint_decode(dspbptk_coder_t* coder, blueprint_t* blueprint, const char* string) {
+    return blueprint_decode_n(coder, blueprint, string, strlen(string));
+}
+
+dspbptk_error_t blueprint_decode_n(dspbptk_coder_t* coder, blueprint_t* blueprint, const char* string, size_t string_length) {
+    return blueprint_decode_filter(coder, blueprint, string, string_length, NULL);
+}
+
+dspbptk_error_t blueprint_decode_filter(dspbptk_coder_t* coder, blueprint_t* blueprint, const char* string, size_t string_length, const dspbptk_filter_t* filter) {
+    // 初始化结构体，置零
+    memset(blueprint, 0, sizeof(blueprint_t));
+    blueprint->allocator = coder->allocator;
+
+    // 检查是不是蓝图，解析head，并根据双引号标记字符串
+    blueprint_head_t head;
+    const char* base64;
+    const char* md5f;
+    dspbptk_error_t errorlevel = split_string(string, string_length, &head, &base64, &md5f);
+    if(errorlevel != no_error)
+        return errorlevel;
     const size_t base64_length = (size_t)(md5f - base64 - 1);
     DBG(base64_length);
 
-    // 解析md5f(并校验)
-#ifndef DSPBPTK_NO_WARNING
-    char md5f_check[MD5F_LENGTH + 1] = "\0";
-    md5f_str(md5f_check, coder->buffer1, string, head_length + 1 + base64_length);
-    if(memcmp(md5f, md5f_check, MD5F_LENGTH) != 0)
-        fprintf(stderr, "Warning: MD5 abnormal!\nthis:\t%s\nactual:\t%s\n", md5f, md5f_check);
-#endif
-    blueprint->md5f = (char*)calloc(32 + 1, sizeof(char));
-    memcpy(blueprint->md5f, md5f, 32);
-
-    // 解析head
-    blueprint->shortDesc = (char*)calloc(SHORTDESC_MAX_LENGTH + 1, sizeof(char));
-    int argument_count = sscanf(string, "BLUEPRINT:0,%"PRId64",%"PRId64",%"PRId64",%"PRId64",%"PRId64",%"PRId64",0,%"PRId64",%"PRId64".%"PRId64".%"PRId64".%"PRId64",%[^\"]",
-        &blueprint->layout,
-        &blueprint->icons[0],
-        &blueprint->icons[1],
-        &blueprint->icons[2],
-        &blueprint->icons[3],
-        &blueprint->icons[4],
-        &blueprint->time,
-        &blueprint->gameVersion[0],
-        &blueprint->gameVersion[1],
-        &blueprint->gameVersion[2],
-        &blueprint->gameVersion[3],
-        blueprint->shortDesc
-    );
-#ifndef DSPBPTK_NO_ERROR
-    if(argument_count != 12)
-        return blueprint_head_broken;
+    blueprint->layout = head.layout;
+    memcpy(blueprint->icons, head.icons, sizeof(head.icons));
+    blueprint->time = head.time;
+    memcpy(blueprint->gameVersion, head.gameVersion, sizeof(head.gameVersion));
+    blueprint->shortDesc = (char*)dspbptk_calloc(&blueprint->allocator, head.shortDesc_length + 1, sizeof(char));
+    blueprint->md5f = (char*)dspbptk_calloc(&blueprint->allocator, MD5F_LENGTH + 1, sizeof(char));
+#ifndef DSPBP_NO_CHECK
+    if(blueprint->shortDesc == NULL || blueprint->md5f == NULL)
+        return out_of_memory;
 #endif
+    memcpy(blueprint->shortDesc, head.shortDesc, head.shortDesc_length);
+    memcpy(blueprint->md5f, md5f, MD5F_LENGTH);
+
+    // 解析base64，得到二进制流
+    void* bin;
+    size_t bin_length;
+    errorlevel = decode_payload(coder, string, base64, base64_length, md5f, &bin, &bin_length, &blueprint->md5f_status);
+    if(errorlevel != no_error)
+        return errorlevel;
 
-    // 解析base64
+    // 解析二进制流
     {
-        // base64解码
-        size_t gzip_length = base64_declen(base64, base64_length);
-        DBG(gzip_length);
-        void* gzip = coder->buffer0;
-    #ifndef DSPBPTK_NO_ERROR
-        if(gzip == NULL)
+        // 用于操作二进制流的指针
+        void* ptr_bin = bin;
+
+        // 解析二进制流的头
+    #define BIN_HEAD_DECODE(name, type)\
+        blueprint->name = (i64_t)*((type*)(ptr_bin + bin_offset_##name));
+        BIN_HEAD_DECODE(version, i32_t);
+        BIN_HEAD_DECODE(cursorOffset_x, i32_t);
+        BIN_HEAD_DECODE(cursorOffset_y, i32_t);
+        BIN_HEAD_DECODE(cursorTargetArea, i32_t);
+        BIN_HEAD_DECODE(dragBoxSize_x, i32_t);
+        BIN_HEAD_DECODE(dragBoxSize_y, i32_t);
+        BIN_HEAD_DECODE(primaryAreaIdx, i32_t);
+
+        // 解析区域数量
+        const size_t AREA_NUM = (size_t) * ((i8_t*)(ptr_bin + BIN_OFFSET_AREA_NUM));
+        blueprint->AREA_NUM = AREA_NUM;
+        blueprint->area = (area_t*)dspbptk_calloc(&blueprint->allocator, AREA_NUM, sizeof(area_t));
+    #ifndef DSPBP_NO_CHECK
+        if(blueprint->area == NULL)
             return out_of_memory;
     #endif
-        gzip_length = base64_dec(base64, base64_length, gzip);
-        DBG(gzip_length);
+        DBG(AREA_NUM);
+
+        // 解析区域数组
+        ptr_bin += BIN_OFFSET_AREA_ARRAY;
+        for(size_t i = 0; i < AREA_NUM; i++) {
+        #define AREA_DECODE(name, type)\
+            blueprint->area[i].name = (i64_t)*((type*)(ptr_bin + area_offset_##name));
+            AREA_DECODE(index, i8_t);
+            AREA_DECODE(parentIndex, i8_t);
+            AREA_DECODE(tropicAnchor, i16_t);
+            AREA_DECODE(areaSegments, i16_t);
+            AREA_DECODE(anchorLocalOffsetX, i16_t);
+            AREA_DECODE(anchorLocalOffsetY, i16_t);
+            AREA_DECODE(width, i16_t);
+            AREA_DECODE(height, i16_t);
+            ptr_bin += AREA_OFFSET_AREA_NEXT;
+        }
+
+        // 解析建筑数量
+    #ifndef DSPBPTK_NO_ERROR
+        if((size_t)(ptr_bin - bin) + sizeof(i32_t) > bin_length)
+            return blueprint_data_broken;
+    #endif
+        const size_t BUILDING_NUM_ALL = (size_t)(uint32_t) * ((i32_t*)(ptr_bin));
+        DBG(BUILDING_NUM_ALL);
     #ifndef DSPBPTK_NO_ERROR
-        if(gzip_length <= 0)
-            return blueprint_base64_broken;
+        // 每个建筑记录至少有building_offset_parameters字节，先检查再按建筑数量分配缓冲区
+        if(BUILDING_NUM_ALL > (bin_length - (size_t)(ptr_bin - bin) - sizeof(i32_t)) / building_offset_parameters)
+            return blueprint_data_broken;
     #endif
 
-        // gzip解压
-        size_t bin_length = gzip_declen(gzip, gzip_length);
-        DBG(bin_length);
-        void* bin = coder->buffer1;
+        // 先扫描一遍得到每个建筑记录的偏移量和参数总数。
+        // 压缩数据此时已经用不到了，偏移量存放在buffer0中
+        uint32_t* building_offset = (uint32_t*)coder_reserve(coder, 0, BUILDING_NUM_ALL * sizeof(uint32_t));
     #ifndef DSPBPTK_NO_ERROR
-        if(bin == NULL)
+        if(building_offset == NULL)
             return out_of_memory;
     #endif
-        bin_length = gzip_dec(coder, gzip, gzip_length, bin);
-        DBG(bin_length);
-    #ifndef DSPBP_NO_CHECK
-        if(bin_length <= 3)
-            return blueprint_gzip_broken;
-    #endif
-
-        // 解析二进制流
-        {
-            // 用于操作二进制流的指针
-            void* ptr_bin = bin;
-
-            // 解析二进制流的头
-        #define BIN_HEAD_DECODE(name, type)\
-            blueprint->name = (i64_t)*((type*)(ptr_bin + bin_offset_##name));
-            BIN_HEAD_DECODE(version, i32_t);
-            BIN_HEAD_DECODE(cursorOffset_x, i32_t);
-            BIN_HEAD_DECODE(cursorOffset_y, i32_t);
-            BIN_HEAD_DECODE(cursorTargetArea, i32_t);
-            BIN_HEAD_DECODE(dragBoxSize_x, i32_t);
-            BIN_HEAD_DECODE(dragBoxSize_y, i32_t);
-            BIN_HEAD_DECODE(primaryAreaIdx, i32_t);
-
-            // 解析区域数量
-            const size_t AREA_NUM = (size_t) * ((i8_t*)(ptr_bin + BIN_OFFSET_AREA_NUM));
-            blueprint->AREA_NUM = AREA_NUM;
-            blueprint->area = (area_t*)calloc(AREA_NUM, sizeof(area_t));
-        #ifndef DSPBP_NO_CHECK
-            if(blueprint->area == NULL)
-                return out_of_memory;
-        #endif
-            DBG(AREA_NUM);
-
-            // 解析区域数组
-            ptr_bin += BIN_OFFSET_AREA_ARRAY;
-            for(size_t i = 0; i < AREA_NUM; i++) {
-            #define AREA_DECODE(name, type)\
-                blueprint->area[i].name = (i64_t)*((type*)(ptr_bin + area_offset_##name));
-                AREA_DECODE(index, i8_t);
-                AREA_DECODE(parentIndex, i8_t);
-                AREA_DECODE(tropicAnchor, i16_t);
-                AREA_DECODE(areaSegments, i16_t);
-                AREA_DECODE(anchorLocalOffsetX, i16_t);
-                AREA_DECODE(anchorLocalOffsetY, i16_t);
-                AREA_DECODE(width, i16_t);
-                AREA_DECODE(height, i16_t);
-                ptr_bin += AREA_OFFSET_AREA_NEXT;
-            }
+        size_t PARAMETERS_NUM_ALL;
+        dspbptk_error_t scan_errorlevel = scan_building(bin, bin_length, (size_t)(ptr_bin - bin) + sizeof(i32_t), BUILDING_NUM_ALL, building_offset, &PARAMETERS_NUM_ALL);
+        if(scan_errorlevel != no_error)
+            return scan_errorlevel;
 
-            // 解析建筑数量
-            const size_t BUILDING_NUM = (size_t) * ((i32_t*)(ptr_bin));
-            blueprint->BUILDING_NUM = BUILDING_NUM;
-            blueprint->building = (building_t*)calloc(BUILDING_NUM, sizeof(building_t));
-        #ifndef DSPBP_NO_CHECK
-            if(blueprint->building == NULL)
-                return out_of_memory;
-        #endif
-            DBG(BUILDING_NUM);
-
-            // 解析建筑数组
-            ptr_bin += sizeof(int32_t);
-            for(size_t i = 0; i < BUILDING_NUM; i++) {
-            #define BUILDING_DECODE(name, type)\
-                blueprint->building[i].name = (i64_t)*((type*)(ptr_bin + building_offset_##name));
-                BUILDING_DECODE(index, i32_t);
-                BUILDING_DECODE(areaIndex, i8_t);
-                // 把建筑坐标转换成齐次坐标
-                blueprint->building[i].localOffset.x = (f64_t) * ((f32_t*)(ptr_bin + building_offset_localOffset_x));
-                blueprint->building[i].localOffset.y = (f64_t) * ((f32_t*)(ptr_bin + building_offset_localOffset_y));
-                blueprint->building[i].localOffset.z = (f64_t) * ((f32_t*)(ptr_bin + building_offset_localOffset_z));
-                blueprint->building[i].localOffset.w = (f64_t)1.0;
-                blueprint->building[i].localOffset2.x = (f64_t) * ((f32_t*)(ptr_bin + building_offset_localOffset_x2));
-                blueprint->building[i].localOffset2.y = (f64_t) * ((f32_t*)(ptr_bin + building_offset_localOffset_y2));
-                blueprint->building[i].localOffset2.z = (f64_t) * ((f32_t*)(ptr_bin + building_offset_localOffset_z2));
-                blueprint->building[i].localOffset2.w = (f64_t)1.0;
-                blueprint->building[i].yaw = (f64_t) * ((f32_t*)(ptr_bin + building_offset_yaw));
-                blueprint->building[i].yaw2 = (f64_t) * ((f32_t*)(ptr_bin + building_offset_yaw2));
-                BUILDING_DECODE(itemId, i16_t);
-                BUILDING_DECODE(modelIndex, i16_t);
-                BUILDING_DECODE(tempOutputObjIdx, i32_t);
-                BUILDING_DECODE(tempInputObjIdx, i32_t);
-                BUILDING_DECODE(outputToSlot, i8_t);
-                BUILDING_DECODE(inputFromSlot, i8_t);
-                BUILDING_DECODE(outputFromSlot, i8_t);
-                BUILDING_DECODE(inputToSlot, i8_t);
-                BUILDING_DECODE(outputOffset, i8_t);
-                BUILDING_DECODE(inputOffset, i8_t);
-                BUILDING_DECODE(recipeId, i16_t);
-                BUILDING_DECODE(filterId, i16_t);
-
-                // DBG(blueprint->building[i].itemId);
-
-                // 解析建筑的参数列表长度
-                const size_t PARAMETERS_NUM = (i64_t) * ((i16_t*)(ptr_bin + building_offset_num));
-                blueprint->building[i].num = PARAMETERS_NUM;
-
-                // 解析建筑的参数列表
-                if(PARAMETERS_NUM > 0) {
-                    blueprint->building[i].parameters = (i64_t*)calloc(PARAMETERS_NUM, sizeof(i64_t));
-                #ifndef DSPBP_NO_CHECK
-                    if(blueprint->building[i].parameters == NULL)
-                        return out_of_memory;
-                #endif
-                }
-                else {
-                    blueprint->building[i].parameters = NULL;
+        // 按filter筛选，只保留符合条件的建筑的偏移量，其余建筑不展开也不分配参数列表
+        size_t BUILDING_NUM = BUILDING_NUM_ALL;
+        if(filter != NULL) {
+            BUILDING_NUM = 0;
+            PARAMETERS_NUM_ALL = 0;
+            for(size_t i = 0; i < BUILDING_NUM_ALL; i++) {
+                const void* ptr_building = bin + building_offset[i];
+                if(filter_building(filter, ptr_building)) {
+                    building_offset[BUILDING_NUM++] = building_offset[i];
+                    PARAMETERS_NUM_ALL += (size_t)(uint16_t) * ((i16_t*)(ptr_building + building_offset_num));
                 }
-                ptr_bin += building_offset_parameters;
-                for(size_t j = 0; j < PARAMETERS_NUM; j++)
-                    blueprint->building[i].parameters[j] = (i64_t) * ((i32_t*)(ptr_bin + j * sizeof(i32_t)));
-                ptr_bin += PARAMETERS_NUM * sizeof(i32_t);
             }
         }
+        DBG(BUILDING_NUM);
+        DBG(PARAMETERS_NUM_ALL);
+
+        // 所有建筑的参数列表一次分配
+        blueprint->BUILDING_NUM = BUILDING_NUM;
+        blueprint->building = (building_t*)dspbptk_calloc(&blueprint->allocator, BUILDING_NUM, sizeof(building_t));
+    #ifndef DSPBP_NO_CHECK
+        if(blueprint->building == NULL)
+            return out_of_memory;
+    #endif
+        blueprint->parameters_memory = dspbptk_calloc(&blueprint->allocator, PARAMETERS_NUM_ALL, sizeof(*blueprint->building->parameters));
+    #ifndef DSPBP_NO_CHECK
+        if(PARAMETERS_NUM_ALL > 0 && blueprint->parameters_memory == NULL)
+            return out_of_memory;
+    #endif
+
+        // 解析建筑数组，建筑很多时分给多个线程
+        size_t thread_num = coder->thread_num;
+        if(BUILDING_NUM < DECODE_PARALLEL_THRESHOLD)
+            thread_num = 1;
+        decode_building_parallel(blueprint, bin, building_offset, BUILDING_NUM, thread_num);
+
+        // 被筛掉的建筑不存在了，指向它们的传送带连接改为OBJ_NULL，保证保留下来的建筑之间的索引是一致的
+        // 偏移量此时已经用不到了，映射表放在buffer0中
+        if(BUILDING_NUM < BUILDING_NUM_ALL)
+            return drop_dangling_index(coder, blueprint);
     }
 
     return no_error;
@@ -289,83 +1145,340 @@ dspbptk_error_t blueprint_decode(dspbptk_coder_t* coder, blueprint_t* blueprint,
 
 
 ////////////////////////////////////////////////////////////////////////////////
-// dspbptk encode
+// dspbptk view
 ////////////////////////////////////////////////////////////////////////////////
 
-typedef struct {
-    i64_t id;
-    i64_t index;
-}index_t;
+dspbptk_error_t blueprint_view_decode(dspbptk_coder_t* coder, blueprint_view_t* view, const char* string) {
+    // 初始化结构体，置零
+    memset(view, 0, sizeof(blueprint_view_t));
+    view->allocator = coder->allocator;
 
-int cmp_building(const void* p_a, const void* p_b) {
-    building_t* a = (building_t*)p_a;
-    building_t* b = (building_t*)p_b;
+    // 检查是不是蓝图，并解析head
+    const char* base64;
+    const char* md5f;
+    dspbptk_error_t errorlevel = split_string(string, strlen(string), &view->head, &base64, &md5f);
+    if(errorlevel != no_error)
+        return errorlevel;
+    view->md5f = md5f;
 
-    // 建筑种类不同时，最优先根据建筑种类排序
-    int tmp = a->itemId - b->itemId;
-    if(tmp != 0)
-        return tmp;
+    // 解析base64，得到二进制流
+    void* bin;
+    size_t bin_length;
+    errorlevel = decode_payload(coder, string, base64, (size_t)(md5f - base64 - 1), md5f, &bin, &bin_length, &view->md5f_status);
+    if(errorlevel != no_error)
+        return errorlevel;
+    view->bin = bin;
+    view->bin_length = bin_length;
 
-    // 建筑种类相同时，根据所在区域排序
-    int tmp_areaIndex = a->areaIndex - b->areaIndex;
-    if(tmp_areaIndex != 0)
-        return tmp_areaIndex;
+    // 区域数组是定长的，直接定位到建筑数组
+    if(bin_length < BIN_OFFSET_AREA_ARRAY)
+        return blueprint_data_broken;
+    view->AREA_NUM = (size_t)(uint8_t) * ((i8_t*)(bin + BIN_OFFSET_AREA_NUM));
+    view->area = bin + BIN_OFFSET_AREA_ARRAY;
+    const size_t building_array = BIN_OFFSET_AREA_ARRAY + view->AREA_NUM * AREA_OFFSET_AREA_NEXT;
+    if(bin_length < building_array + sizeof(i32_t))
+        return blueprint_data_broken;
 
-    // 区域也相同时，根据y>x>z的优先级排序
-    const double K = 1024.0;
-    double score_pos_a = (a->localOffset.y * K + a->localOffset.x) * K + a->localOffset.z;
-    double score_pos_b = (b->localOffset.y * K + b->localOffset.x) * K + b->localOffset.z;
-    if(score_pos_a < score_pos_b)
-        return 1;
-    else
-        return -1;
+    // 建立建筑记录的偏移量索引
+    const size_t BUILDING_NUM = (size_t)(uint32_t) * ((i32_t*)(bin + building_array));
+    // 每个建筑记录至少有building_offset_parameters字节，先检查再按建筑数量分配索引
+    if(BUILDING_NUM > (bin_length - building_array - sizeof(i32_t)) / building_offset_parameters)
+        return blueprint_data_broken;
+    view->building_offset = (uint32_t*)dspbptk_calloc(&view->allocator, BUILDING_NUM, sizeof(uint32_t));
+    if(view->building_offset == NULL)
+        return out_of_memory;
+    view->BUILDING_NUM = BUILDING_NUM;
+    DBG(BUILDING_NUM);
+
+    return scan_building(bin, bin_length, building_array + sizeof(i32_t), BUILDING_NUM, view->building_offset, NULL);
 }
 
-int cmp_id(const void* p_a, const void* p_b) {
-    index_t* a = ((index_t*)p_a);
-    index_t* b = ((index_t*)p_b);
-    return a->id - b->id;
+
+
+////////////////////////////////////////////////////////////////////////////////
+// dspbptk verify
+////////////////////////////////////////////////////////////////////////////////
+
+#define VERIFY_BATCH_LENGTH 256
+
+void blueprint_verify_batch(const char* const* string, const size_t* string_length, size_t num, md5f_status_t* md5f_status) {
+    const char* stream[VERIFY_BATCH_LENGTH];
+    size_t stream_length[VERIFY_BATCH_LENGTH];
+    size_t stream_index[VERIFY_BATCH_LENGTH];
+    const char* md5f[VERIFY_BATCH_LENGTH];
+    char md5f_check[VERIFY_BATCH_LENGTH][MD5F_LENGTH + 1];
+
+    for(size_t i = 0; i < num; i += VERIFY_BATCH_LENGTH) {
+        const size_t batch_num = num - i < VERIFY_BATCH_LENGTH ? num - i : VERIFY_BATCH_LENGTH;
+
+        // 只解析head来找到md5f覆盖的范围，不是蓝图的字符串不参与计算
+        size_t stream_num = 0;
+        for(size_t j = i; j < i + batch_num; j++) {
+            md5f_status[j] = md5f_unchecked;
+            const size_t length = string_length != NULL ? string_length[j] : strlen(string[j]);
+            blueprint_head_t head;
+            const char* base64;
+            if(split_string(string[j], length, &head, &base64, &md5f[stream_num]) != no_error)
+                continue;
+            stream[stream_num] = string[j];
+            stream_length[stream_num] = (size_t)(md5f[stream_num] - 1 - string[j]);
+            stream_index[stream_num] = j;
+            stream_num++;
+        }
+
+        md5f_multi_str(md5f_check, stream, stream_length, stream_num);
+        for(size_t k = 0; k < stream_num; k++)
+            md5f_status[stream_index[k]] = memcmp(md5f[k], md5f_check[k], MD5F_LENGTH) == 0 ? md5f_ok : md5f_mismatch;
+    }
 }
 
-void re_index(i64_t* ObjIdx, index_t* id_lut, size_t BUILDING_NUM) {
-    if(*ObjIdx == OBJ_NULL)
-        return;
-    index_t* p_id = bsearch(ObjIdx, id_lut, BUILDING_NUM, sizeof(index_t), cmp_id);
-    if(p_id == NULL) {
+
+
+////////////////////////////////////////////////////////////////////////////////
+// dspbptk encode
+////////////////////////////////////////////////////////////////////////////////
+
+i64_t re_index(i64_t ObjIdx, const id_map_t* map) {
+    if(ObjIdx == OBJ_NULL)
+        return OBJ_NULL;
+    const i32_t position = id_map_find(map, ObjIdx);
+    if(position == OBJ_NULL) {
     #ifndef DSPBPTK_NO_WARNING
-        fprintf(stderr, "Warning: index %"PRId64" no found! Reindex index to OBJ_NULL(-1).\n", *ObjIdx);
+        fprintf(stderr, "Warning: index %"PRId64" no found! Reindex index to OBJ_NULL(-1).\n", ObjIdx);
     #endif
-        * ObjIdx = OBJ_NULL;
+        return OBJ_NULL;
     }
-    else {
-        *ObjIdx = p_id->index;
+    return position;
+}
+
+// 输出head，blueprint可以是任何带有head各字段的蓝图结构体
+#define HEAD_FORMAT "BLUEPRINT:0,%"PRId64",%"PRId64",%"PRId64",%"PRId64",%"PRId64",%"PRId64",0,%"PRId64",%"PRId64".%"PRId64".%"PRId64".%"PRId64",%s\""
+#define HEAD_ARGS(blueprint)\
+        (blueprint)->layout,\
+        (blueprint)->icons[0],\
+        (blueprint)->icons[1],\
+        (blueprint)->icons[2],\
+        (blueprint)->icons[3],\
+        (blueprint)->icons[4],\
+        (blueprint)->time,\
+        (blueprint)->gameVersion[0],\
+        (blueprint)->gameVersion[1],\
+        (blueprint)->gameVersion[2],\
+        (blueprint)->gameVersion[3],\
+        (blueprint)->shortDesc
+// 输出head和双引号
+#define HEAD_ENCODE(string, blueprint)\
+    sprintf(string, HEAD_FORMAT, HEAD_ARGS(blueprint))
+// head和双引号的长度，不输出
+#define HEAD_ENCODE_LENGTH(blueprint)\
+    snprintf(NULL, 0, HEAD_FORMAT, HEAD_ARGS(blueprint))
+
+/**
+ * @brief 把二进制流gzip压缩、base64编码，接在head之后，最后输出md5f
+ *
+ * @param string 已经输出了head和双引号的蓝图字符串
+ * @param head_length head的长度，不含双引号
+ * @param bin 二进制流，位于coder->buffer0中
+ * @param bin_length 二进制流长度
+ * @param string_capacity string的容量，含结尾的'\0'
+ * @param compression_level gzip的压缩等级
+ * @return dspbptk_error_t 错误代码
+ */
+dspbptk_error_t encode_payload(dspbptk_coder_t* coder, char* string, size_t head_length, const void* bin, size_t bin_length, size_t string_capacity, int compression_level) {
+    char* ptr_str = string + head_length + 1;
+    struct libdeflate_compressor* compressor = coder_compressor(coder, compression_level);
+    if(compressor == NULL)
+        return out_of_memory;
+    const size_t gzip_capacity = gzip_bound(compressor, bin_length);
+    void* gzip = coder_reserve(coder, 1, gzip_capacity);
+    if(gzip == NULL)
+        return out_of_memory;
+    size_t gzip_length = gzip_enc(compressor, bin, bin_length, gzip, gzip_capacity);
+
+    // 压缩后才知道蓝图字符串的准确长度：head、双引号、base64、双引号、md5f、'\0'
+    if(head_length + 1 + TB64ENCLEN(gzip_length) + 1 + MD5F_LENGTH + 1 > string_capacity)
+        return string_too_short;
+
+    // 按块base64编码，每块刚输出还在缓存里时就计算md5f，不再整个字符串重新读一遍。
+    // 每块的输入长度是3的倍数，分块编码的结果和一次编码相同
+    md5f_ctx_t md5f_ctx;
+    md5f_init(&md5f_ctx);
+    md5f_update(&md5f_ctx, string, head_length + 1);
+    const size_t chunk_gzip_length_max = BASE64_CHUNK_LENGTH / 4 * 3;
+    size_t base64_length = 0;
+    for(size_t offset = 0; offset < gzip_length; offset += chunk_gzip_length_max) {
+        const size_t chunk_gzip_length = gzip_length - offset < chunk_gzip_length_max ?
+            gzip_length - offset : chunk_gzip_length_max;
+        const size_t chunk_length = base64_enc(gzip + offset, chunk_gzip_length, ptr_str + base64_length);
+        md5f_update(&md5f_ctx, ptr_str + base64_length, chunk_length);
+        base64_length += chunk_length;
     }
+
+    // 输出md5f
+    char md5f_hex[MD5F_LENGTH + 1] = "\0";
+    md5f_final_str(&md5f_ctx, md5f_hex);
+    ptr_str += base64_length;
+    sprintf(ptr_str, "\"%s", md5f_hex);
+
+    return no_error;
 }
 
+/**
+ * @brief 计算蓝图编码后二进制流的准确长度，用于事先准备缓冲区
+ */
+size_t blueprint_bin_length(const blueprint_t* blueprint) {
+    size_t bin_length = BIN_OFFSET_AREA_ARRAY + blueprint->AREA_NUM * AREA_OFFSET_AREA_NEXT + sizeof(i32_t);
+    for(size_t i = 0; i < blueprint->BUILDING_NUM; i++)
+        bin_length += building_offset_parameters + sizeof(i32_t) * (size_t)(uint16_t)blueprint->building[i].num;
+    return bin_length;
+}
+
+/**
+ * @brief 同blueprint_bin_length，用于blueprint_soa_t
+ */
+size_t blueprint_soa_bin_length(const blueprint_soa_t* blueprint) {
+    size_t bin_length = BIN_OFFSET_AREA_ARRAY + blueprint->AREA_NUM * AREA_OFFSET_AREA_NEXT + sizeof(i32_t);
+    for(size_t i = 0; i < blueprint->BUILDING_NUM; i++)
+        bin_length += building_offset_parameters + sizeof(i32_t) * (size_t)(uint16_t)blueprint->num[i];
+    return bin_length;
+}
+
+// 建筑的排序依据，预先算好后按(group, score)基数排序
+typedef struct {
+    uint64_t score;     // 位置得分按大小映射成的无符号整数
+    uint32_t group;     // 建筑种类和所在区域
+    uint32_t index;     // 建筑原来的位置
+}building_order_t;
+
+/**
+ * @brief 算出一个建筑的排序依据。建筑的输出顺序：建筑种类优先，其次是所在区域，再按y>x>z的优先级，得分高的在前，
+ * 最后按建筑原来的位置。这是一个全序，排序结果不依赖排序算法和libc。
+ * 建筑种类和区域按写入二进制流的i16_t、i8_t比较
+ */
+static inline void building_order_set(building_order_t* order, i64_t itemId, i64_t areaIndex, f64_t localOffset_x, f64_t localOffset_y, f64_t localOffset_z, size_t index) {
+    // K是2的幂，乘K没有舍入，每一步只在加法时舍入一次，所以编译器合并成FMA也不影响结果。
+    // 中间结果用volatile固定下来，避免-Ofast重新结合运算顺序，使得分在不同的编译器、编译选项下逐位相同
+    const double K = 1024.0;
+    volatile f64_t score_yx = localOffset_y * K + localOffset_x;
+    const f64_t score = score_yx * K + localOffset_z;
+    uint64_t bits;
+    memcpy(&bits, &score, sizeof(uint64_t));
+    // -0.0和0.0相等
+    if((bits << 1) == 0)
+        bits = 0;
+    // 按浮点数大小映射成无符号整数，再取反使得分高的排在前面
+    bits = (bits >> 63) ? ~bits : bits | (UINT64_C(1) << 63);
+    order->score = ~bits;
+    order->group = ((uint32_t)(uint16_t)((i16_t)itemId ^ INT16_MIN) << 8) | (uint32_t)(uint8_t)((i8_t)areaIndex ^ INT8_MIN);
+    order->index = (uint32_t)index;
+}
+
+// 排序依据的字节数：score 8字节，group 3字节
+#define ORDER_RADIX_PASS 11
+
+/**
+ * @brief 取出排序依据的第pass个字节，从最低位开始
+ */
+static inline size_t order_radix_byte(const building_order_t* order, int pass) {
+    return pass < 8 ? (size_t)(order->score >> (pass * 8)) & 0xff : (size_t)(order->group >> ((pass - 8) * 8)) & 0xff;
+}
+
+/**
+ * @brief 对排序依据做LSD基数排序。每一趟都是稳定的，依据相同的建筑保持原来的顺序
+ *
+ * @param order 待排序的数组
+ * @param temp 和order一样长的临时空间
+ * @return building_order_t* 排序结果，是order或temp
+ */
+building_order_t* sort_building_order(building_order_t* order, building_order_t* temp, size_t BUILDING_NUM) {
+    // 一遍统计出每一趟的直方图。建筑数量不超过i32_t的范围，计数用uint32_t，整个直方图放在栈上
+    if(BUILDING_NUM == 0)
+        return order;
+    uint32_t histogram[ORDER_RADIX_PASS][256];
+    memset(histogram, 0, sizeof(histogram));
+    for(size_t i = 0; i < BUILDING_NUM; i++) {
+        for(int pass = 0; pass < ORDER_RADIX_PASS; pass++)
+            histogram[pass][order_radix_byte(&order[i], pass)]++;
+    }
+
+    building_order_t* src = order;
+    building_order_t* dst = temp;
+    for(int pass = 0; pass < ORDER_RADIX_PASS; pass++) {
+        // 这一字节全部相同时跳过这一趟，建筑种类、区域的高位通常如此
+        if(histogram[pass][order_radix_byte(&src[0], pass)] == BUILDING_NUM)
+            continue;
+        uint32_t offset = 0;
+        for(size_t b = 0; b < 256; b++) {
+            const uint32_t count = histogram[pass][b];
+            histogram[pass][b] = offset;
+            offset += count;
+        }
+        for(size_t i = 0; i < BUILDING_NUM; i++)
+            dst[histogram[pass][order_radix_byte(&src[i], pass)]++] = src[i];
+        building_order_t* swap = src;
+        src = dst;
+        dst = swap;
+    }
+    return src;
+}
+
+size_t blueprint_encode_bound(const blueprint_t* blueprint) {
+    const size_t head_length = (size_t)HEAD_ENCODE_LENGTH(blueprint);
+    const size_t gzip_length = libdeflate_gzip_compress_bound(NULL, blueprint_bin_length(blueprint));
+    return head_length + TB64ENCLEN(gzip_length) + 1 + MD5F_LENGTH + 1;
+}
+
+size_t blueprint_encode_soa_bound(const blueprint_soa_t* blueprint) {
+    const size_t head_length = (size_t)HEAD_ENCODE_LENGTH(blueprint);
+    const size_t gzip_length = libdeflate_gzip_compress_bound(NULL, blueprint_soa_bin_length(blueprint));
+    return head_length + TB64ENCLEN(gzip_length) + 1 + MD5F_LENGTH + 1;
+}
+
+const dspbptk_encode_options_t dspbptk_encode_fast = {1, 0};
+const dspbptk_encode_options_t dspbptk_encode_balanced = {6, 1};
+const dspbptk_encode_options_t dspbptk_encode_smallest = {COMPRESSION_LEVEL_MAX, 1};
+
 dspbptk_error_t blueprint_encode(dspbptk_coder_t* coder, const blueprint_t* blueprint, char* string) {
+    return blueprint_encode_opt(coder, blueprint, string, SIZE_MAX, NULL);
+}
+
+dspbptk_error_t blueprint_encode_n(dspbptk_coder_t* coder, const blueprint_t* blueprint, char* string, size_t string_capacity) {
+    return blueprint_encode_opt(coder, blueprint, string, string_capacity, NULL);
+}
+
+dspbptk_error_t blueprint_encode_opt(dspbptk_coder_t* coder, const blueprint_t* blueprint, char* string, size_t string_capacity, const dspbptk_encode_options_t* options) {
+    const int compression_level = options != NULL ? options->compression_level : coder->compression_level;
+    const int sort_building = options != NULL ? options->sort_building : 1;
+    if(coder->decode_only)
+        return coder_decode_only;
+    // 先确认head能放下，base64部分的长度在压缩后检查
+    if((size_t)HEAD_ENCODE_LENGTH(blueprint) + 1 + MD5F_LENGTH + 1 > string_capacity)
+        return string_too_short;
+
+    // 按二进制流的准确长度准备缓冲区
+    void* bin = coder_reserve(coder, 0, blueprint_bin_length(blueprint));
+    if(bin == NULL)
+        return out_of_memory;
+    // buffer1存放排序用的order、基数排序的临时空间和index的映射表，压缩时buffer1再按gzip的长度准备
+    const size_t BUILDING_NUM = blueprint->BUILDING_NUM;
+    i64_t min_id = BUILDING_NUM > 0 ? blueprint->building[0].index : 0;
+    i64_t max_id = min_id;
+    for(size_t i = 1; i < BUILDING_NUM; i++) {
+        const i64_t id = blueprint->building[i].index;
+        min_id = id < min_id ? id : min_id;
+        max_id = id > max_id ? id : max_id;
+    }
+    id_map_t id_map;
+    const size_t id_map_length = id_map_init(&id_map, min_id, max_id, BUILDING_NUM);
+    building_order_t* order = (building_order_t*)coder_reserve(coder, 1, BUILDING_NUM * 2 * sizeof(building_order_t) + id_map_length);
+    if(order == NULL)
+        return out_of_memory;
 
     // 初始化用于操作的几个指针
-    void* bin = coder->buffer0;
-    char* ptr_str = string;
     void* ptr_bin = bin;
 
     // 输出head
-    sprintf(string, "BLUEPRINT:0,%"PRId64",%"PRId64",%"PRId64",%"PRId64",%"PRId64",%"PRId64",0,%"PRId64",%"PRId64".%"PRId64".%"PRId64".%"PRId64",%s\"",
-        blueprint->layout,
-        blueprint->icons[0],
-        blueprint->icons[1],
-        blueprint->icons[2],
-        blueprint->icons[3],
-        blueprint->icons[4],
-        blueprint->time,
-        blueprint->gameVersion[0],
-        blueprint->gameVersion[1],
-        blueprint->gameVersion[2],
-        blueprint->gameVersion[3],
-        blueprint->shortDesc
-    );
-    size_t head_length = strlen(string) - 1;
-    ptr_str += head_length + 1;
+    size_t head_length = (size_t)HEAD_ENCODE(string, blueprint) - 1;
 
     // 编码bin head
 #define BIN_HEAD_ENCODE(name, type)\
@@ -403,45 +1516,57 @@ dspbptk_error_t blueprint_encode(dspbptk_coder_t* coder, const blueprint_t* blue
     *((i32_t*)(ptr_bin)) = (i32_t)blueprint->BUILDING_NUM;
     DBG(*((i32_t*)(ptr_bin)));
 
+    // 计算建筑的输出顺序，不改动blueprint本身，同一个蓝图可以反复编码、被多个线程同时编码
+    for(size_t i = 0; i < BUILDING_NUM; i++) {
+        const building_t* building = &blueprint->building[i];
+        building_order_set(&order[i], building->itemId, building->areaIndex,
+            (f64_t)building->localOffset.x, (f64_t)building->localOffset.y, (f64_t)building->localOffset.z, i);
+    }
+    building_order_t* order_temp = order + BUILDING_NUM;
 #ifndef DSPBPTK_DONT_SORT_BUILDING
     // 对建筑按建筑类型排序，有利于进一步压缩，非必要步骤
-    qsort(blueprint->building, blueprint->BUILDING_NUM, sizeof(building_t), cmp_building);
+    if(sort_building)
+        order = sort_building_order(order, order_temp, BUILDING_NUM);
+#else
+    (void)sort_building;
 #endif
 
     // 重新生成index
-    index_t* id_lut = (index_t*)coder->buffer1;
-    for(size_t i = 0; i < blueprint->BUILDING_NUM; i++) {
-        id_lut[i].id = blueprint->building[i].index;
-        id_lut[i].index = i;
-    }
-    qsort(id_lut, blueprint->BUILDING_NUM, sizeof(index_t), cmp_id);
-    for(size_t i = 0; i < blueprint->BUILDING_NUM; i++) {
-        re_index(&blueprint->building[i].index, id_lut, blueprint->BUILDING_NUM);
-        re_index(&blueprint->building[i].tempOutputObjIdx, id_lut, blueprint->BUILDING_NUM);
-        re_index(&blueprint->building[i].tempInputObjIdx, id_lut, blueprint->BUILDING_NUM);
-    }
+    id_map_attach(&id_map, order_temp + BUILDING_NUM);
+    for(size_t i = 0; i < BUILDING_NUM; i++)
+        id_map_insert(&id_map, blueprint->building[order[i].index].index, i);
 
-    // 编码建筑数组
+    // 按排序后的顺序编码建筑数组
     ptr_bin += sizeof(i32_t);
-    for(size_t i = 0; i < blueprint->BUILDING_NUM; i++) {
+    for(size_t k = 0; k < BUILDING_NUM; k++) {
+        const building_t* building = &blueprint->building[order[k].index];
     #define BUILDING_ENCODE(name, type)\
-        {*((type*)(ptr_bin + building_offset_##name)) = (type)blueprint->building[i].name;}
-        BUILDING_ENCODE(index, i32_t);
+        {*((type*)(ptr_bin + building_offset_##name)) = (type)building->name;}
+    #define BUILDING_REINDEX(name)\
+        {*((i32_t*)(ptr_bin + building_offset_##name)) = (i32_t)re_index(building->name, &id_map);}
+        BUILDING_REINDEX(index);
         BUILDING_ENCODE(areaIndex, i8_t);
-        f64_t w = blueprint->building[i].localOffset.w;
-        *((f32_t*)(ptr_bin + building_offset_localOffset_x)) = (f32_t)(blueprint->building[i].localOffset.x / w);
-        *((f32_t*)(ptr_bin + building_offset_localOffset_y)) = (f32_t)(blueprint->building[i].localOffset.y / w);
-        *((f32_t*)(ptr_bin + building_offset_localOffset_z)) = (f32_t)(blueprint->building[i].localOffset.z / w);
-        f64_t w2 = blueprint->building[i].localOffset2.w;
-        *((f32_t*)(ptr_bin + building_offset_localOffset_x2)) = (f32_t)(blueprint->building[i].localOffset2.x / w2);
-        *((f32_t*)(ptr_bin + building_offset_localOffset_y2)) = (f32_t)(blueprint->building[i].localOffset2.y / w2);
-        *((f32_t*)(ptr_bin + building_offset_localOffset_z2)) = (f32_t)(blueprint->building[i].localOffset2.z / w2);
-        *((f32_t*)(ptr_bin + building_offset_yaw)) = (f32_t)(blueprint->building[i].yaw);
-        *((f32_t*)(ptr_bin + building_offset_yaw2)) = (f32_t)(blueprint->building[i].yaw2);
+    #ifndef DSPBPTK_COMPACT_BUILDING
+        f64_t w = building->localOffset.w;
+        *((f32_t*)(ptr_bin + building_offset_localOffset_x)) = (f32_t)(building->localOffset.x / w);
+        *((f32_t*)(ptr_bin + building_offset_localOffset_y)) = (f32_t)(building->localOffset.y / w);
+        *((f32_t*)(ptr_bin + building_offset_localOffset_z)) = (f32_t)(building->localOffset.z / w);
+        f64_t w2 = building->localOffset2.w;
+        *((f32_t*)(ptr_bin + building_offset_localOffset_x2)) = (f32_t)(building->localOffset2.x / w2);
+        *((f32_t*)(ptr_bin + building_offset_localOffset_y2)) = (f32_t)(building->localOffset2.y / w2);
+        *((f32_t*)(ptr_bin + building_offset_localOffset_z2)) = (f32_t)(building->localOffset2.z / w2);
+        *((f32_t*)(ptr_bin + building_offset_yaw)) = (f32_t)(building->yaw);
+        *((f32_t*)(ptr_bin + building_offset_yaw2)) = (f32_t)(building->yaw2);
+    #else
+        memcpy(ptr_bin + building_offset_localOffset_x, &building->localOffset, sizeof(f32x3_t));
+        memcpy(ptr_bin + building_offset_localOffset_x2, &building->localOffset2, sizeof(f32x3_t));
+        memcpy(ptr_bin + building_offset_yaw, &building->yaw, sizeof(f32_t));
+        memcpy(ptr_bin + building_offset_yaw2, &building->yaw2, sizeof(f32_t));
+    #endif
         BUILDING_ENCODE(itemId, i16_t);
         BUILDING_ENCODE(modelIndex, i16_t);
-        BUILDING_ENCODE(tempOutputObjIdx, i32_t);
-        BUILDING_ENCODE(tempInputObjIdx, i32_t);
+        BUILDING_REINDEX(tempOutputObjIdx);
+        BUILDING_REINDEX(tempInputObjIdx);
         BUILDING_ENCODE(outputToSlot, i8_t);
         BUILDING_ENCODE(inputFromSlot, i8_t);
         BUILDING_ENCODE(outputFromSlot, i8_t);
@@ -454,42 +1579,262 @@ dspbptk_error_t blueprint_encode(dspbptk_coder_t* coder, const blueprint_t* blue
         // 编码建筑的参数列表长度
         BUILDING_ENCODE(num, i16_t);
 
-        // 编码建筑的参数列表
+        // 编码建筑的参数列表，长度和写入的i16_t一致，按无符号数处理
+        const size_t PARAMETERS_NUM = (size_t)(uint16_t)building->num;
         ptr_bin += building_offset_parameters;
-        for(size_t j = 0; j < blueprint->building[i].num; j++) {
-            *((i32_t*)(ptr_bin + sizeof(i32_t) * j)) = (i32_t)blueprint->building[i].parameters[j];
+    #ifndef DSPBPTK_COMPACT_BUILDING
+        for(size_t j = 0; j < PARAMETERS_NUM; j++) {
+            *((i32_t*)(ptr_bin + sizeof(i32_t) * j)) = (i32_t)building->parameters[j];
         }
-        ptr_bin += sizeof(i32_t) * blueprint->building[i].num;
+    #else
+        if(PARAMETERS_NUM > 0)
+            memcpy(ptr_bin, building->parameters, sizeof(i32_t) * PARAMETERS_NUM);
+    #endif
+        ptr_bin += sizeof(i32_t) * PARAMETERS_NUM;
     }
 
     // 计算二进制流长度
     size_t bin_length = (size_t)(ptr_bin - bin);
-    void* gzip = coder->buffer1;
-    size_t gzip_length = gzip_enc(coder, bin, bin_length, gzip);
-    size_t base64_length = base64_enc(gzip, gzip_length, ptr_str);
+    return encode_payload(coder, string, head_length, bin, bin_length, string_capacity, compression_level);
+}
 
-    // 计算md5f
-    char md5f_hex[MD5F_LENGTH + 1] = "\0";
-    md5f_str(md5f_hex, coder->buffer1, string, head_length + 1 + base64_length);
-    ptr_str += base64_length;
-    sprintf(ptr_str, "\"%s", md5f_hex);
+////////////////////////////////////////////////////////////////////////////////
+// dspbptk soa
+////////////////////////////////////////////////////////////////////////////////
+
+#define SOA_ALIGN(size) (((size) + 63) & ~(size_t)63)
+
+dspbptk_error_t blueprint_decode_soa(dspbptk_coder_t* coder, blueprint_soa_t* blueprint, const char* string) {
+    // 初始化结构体，置零
+    memset(blueprint, 0, sizeof(blueprint_soa_t));
+    blueprint->allocator = coder->allocator;
+
+    // 检查是不是蓝图，并解析head
+    blueprint_head_t head;
+    const char* base64;
+    const char* md5f;
+    dspbptk_error_t errorlevel = split_string(string, strlen(string), &head, &base64, &md5f);
+    if(errorlevel != no_error)
+        return errorlevel;
+    blueprint->layout = head.layout;
+    memcpy(blueprint->icons, head.icons, sizeof(head.icons));
+    blueprint->time = head.time;
+    memcpy(blueprint->gameVersion, head.gameVersion, sizeof(head.gameVersion));
+    blueprint->shortDesc = (char*)dspbptk_calloc(&blueprint->allocator, head.shortDesc_length + 1, sizeof(char));
+    blueprint->md5f = (char*)dspbptk_calloc(&blueprint->allocator, MD5F_LENGTH + 1, sizeof(char));
+    if(blueprint->shortDesc == NULL || blueprint->md5f == NULL)
+        return out_of_memory;
+    memcpy(blueprint->shortDesc, head.shortDesc, head.shortDesc_length);
+    memcpy(blueprint->md5f, md5f, MD5F_LENGTH);
+
+    // 解析base64，得到二进制流
+    void* bin;
+    size_t bin_length;
+    errorlevel = decode_payload(coder, string, base64, (size_t)(md5f - base64 - 1), md5f, &bin, &bin_length, &blueprint->md5f_status);
+    if(errorlevel != no_error)
+        return errorlevel;
+
+    // 解析二进制流的头
+    if(bin_length < BIN_OFFSET_AREA_ARRAY)
+        return blueprint_data_broken;
+#define BIN_HEAD_DECODE_SOA(name, type)\
+    blueprint->name = (i64_t)*((type*)(bin + bin_offset_##name));
+    BIN_HEAD_FIELDS(BIN_HEAD_DECODE_SOA)
+
+    // 解析区域数组，区域数量很少，仍然按行存储
+    const size_t AREA_NUM = (size_t)(uint8_t) * ((i8_t*)(bin + BIN_OFFSET_AREA_NUM));
+    const size_t building_array = BIN_OFFSET_AREA_ARRAY + AREA_NUM * AREA_OFFSET_AREA_NEXT;
+    if(bin_length < building_array + sizeof(i32_t))
+        return blueprint_data_broken;
+    blueprint->area = (area_t*)dspbptk_calloc(&blueprint->allocator, AREA_NUM, sizeof(area_t));
+    if(blueprint->area == NULL)
+        return out_of_memory;
+    blueprint->AREA_NUM = AREA_NUM;
+    for(size_t i = 0; i < AREA_NUM; i++) {
+        const void* ptr_area = bin + BIN_OFFSET_AREA_ARRAY + i * AREA_OFFSET_AREA_NEXT;
+    #define AREA_DECODE_SOA(name, type)\
+        blueprint->area[i].name = (i64_t)*((type*)(ptr_area + area_offset_##name));
+        AREA_FIELDS(AREA_DECODE_SOA)
+    }
+
+    // 先扫描一遍得到参数总数，所有数组一次分配
+    const size_t BUILDING_NUM = (size_t)(uint32_t) * ((i32_t*)(bin + building_array));
+    size_t PARAMETERS_NUM_ALL;
+    errorlevel = scan_building(bin, bin_length, building_array + sizeof(i32_t), BUILDING_NUM, NULL, &PARAMETERS_NUM_ALL);
+    if(errorlevel != no_error)
+        return errorlevel;
+    DBG(BUILDING_NUM);
+    DBG(PARAMETERS_NUM_ALL);
+
+    size_t memory_size = 0;
+#define BUILDING_SOA_SIZE(name, type)\
+    memory_size += SOA_ALIGN(BUILDING_NUM * sizeof(type));
+    BUILDING_FIELDS(BUILDING_SOA_SIZE)
+    memory_size += SOA_ALIGN((BUILDING_NUM + 1) * sizeof(size_t)) + PARAMETERS_NUM_ALL * sizeof(i32_t);
+    blueprint->building_memory = dspbptk_calloc(&blueprint->allocator, memory_size, 1);
+    if(blueprint->building_memory == NULL)
+        return out_of_memory;
+    blueprint->BUILDING_NUM = BUILDING_NUM;
+
+    void* ptr_memory = blueprint->building_memory;
+#define BUILDING_SOA_ASSIGN(name, type)\
+    blueprint->name = (type*)ptr_memory;\
+    ptr_memory += SOA_ALIGN(BUILDING_NUM * sizeof(type));
+    BUILDING_FIELDS(BUILDING_SOA_ASSIGN)
+    blueprint->parameters_offset = (size_t*)ptr_memory;
+    ptr_memory += SOA_ALIGN((BUILDING_NUM + 1) * sizeof(size_t));
+    blueprint->parameters = (i32_t*)ptr_memory;
+
+    // 解析建筑数组，每个字段写入各自的数组
+    const void* ptr_bin = bin + building_array + sizeof(i32_t);
+    size_t parameters_offset = 0;
+    for(size_t i = 0; i < BUILDING_NUM; i++) {
+    #define BUILDING_DECODE_SOA(name, type)\
+        blueprint->name[i] = *((type*)(ptr_bin + building_offset_##name));
+        BUILDING_FIELDS(BUILDING_DECODE_SOA)
+        const size_t PARAMETERS_NUM = (size_t)(uint16_t)blueprint->num[i];
+        blueprint->parameters_offset[i] = parameters_offset;
+        memcpy(blueprint->parameters + parameters_offset, ptr_bin + building_offset_parameters, PARAMETERS_NUM * sizeof(i32_t));
+        parameters_offset += PARAMETERS_NUM;
+        ptr_bin += building_offset_parameters + PARAMETERS_NUM * sizeof(i32_t);
+    }
+    blueprint->parameters_offset[BUILDING_NUM] = parameters_offset;
 
     return no_error;
 }
 
+dspbptk_error_t blueprint_encode_soa(dspbptk_coder_t* coder, const blueprint_soa_t* blueprint, char* string) {
+    return blueprint_encode_soa_opt(coder, blueprint, string, SIZE_MAX, NULL);
+}
+
+dspbptk_error_t blueprint_encode_soa_opt(dspbptk_coder_t* coder, const blueprint_soa_t* blueprint, char* string, size_t string_capacity, const dspbptk_encode_options_t* options) {
+    const int compression_level = options != NULL ? options->compression_level : coder->compression_level;
+    const int sort_building = options != NULL ? options->sort_building : 1;
+    if(coder->decode_only)
+        return coder_decode_only;
+    // 先确认head能放下，base64部分的长度在压缩后检查
+    if((size_t)HEAD_ENCODE_LENGTH(blueprint) + 1 + MD5F_LENGTH + 1 > string_capacity)
+        return string_too_short;
+    const size_t BUILDING_NUM = blueprint->BUILDING_NUM;
+
+    // 按二进制流的准确长度准备缓冲区，buffer1存放排序用的order、基数排序的临时空间和index的映射表
+    void* bin = coder_reserve(coder, 0, blueprint_soa_bin_length(blueprint));
+    if(bin == NULL)
+        return out_of_memory;
+    i64_t min_id = BUILDING_NUM > 0 ? blueprint->index[0] : 0;
+    i64_t max_id = min_id;
+    for(size_t i = 1; i < BUILDING_NUM; i++) {
+        const i64_t id = blueprint->index[i];
+        min_id = id < min_id ? id : min_id;
+        max_id = id > max_id ? id : max_id;
+    }
+    id_map_t id_map;
+    const size_t id_map_length = id_map_init(&id_map, min_id, max_id, BUILDING_NUM);
+    building_order_t* order = (building_order_t*)coder_reserve(coder, 1, BUILDING_NUM * 2 * sizeof(building_order_t) + id_map_length);
+    if(order == NULL)
+        return out_of_memory;
+
+    // 初始化用于操作的几个指针
+    void* ptr_bin = bin;
+
+    // 输出head
+    size_t head_length = (size_t)HEAD_ENCODE(string, blueprint) - 1;
+
+    // 编码bin head
+#define BIN_HEAD_ENCODE_SOA(name, type)\
+    *((type*)(ptr_bin + bin_offset_##name)) = (type)blueprint->name;
+    BIN_HEAD_FIELDS(BIN_HEAD_ENCODE_SOA)
+
+    // 编码区域
+    *((i8_t*)(ptr_bin + BIN_OFFSET_AREA_NUM)) = (i8_t)blueprint->AREA_NUM;
+    ptr_bin += BIN_OFFSET_AREA_ARRAY;
+    for(size_t i = 0; i < blueprint->AREA_NUM; i++) {
+    #define AREA_ENCODE_SOA(name, type)\
+        *((type*)(ptr_bin + area_offset_##name)) = (type)blueprint->area[i].name;
+        AREA_FIELDS(AREA_ENCODE_SOA)
+        ptr_bin += AREA_OFFSET_AREA_NEXT;
+    }
+
+    // 编码建筑总数
+    *((i32_t*)(ptr_bin)) = (i32_t)BUILDING_NUM;
+    ptr_bin += sizeof(i32_t);
+
+    // 计算建筑的输出顺序，不改动blueprint本身
+    for(size_t i = 0; i < BUILDING_NUM; i++) {
+        building_order_set(&order[i], blueprint->itemId[i], blueprint->areaIndex[i],
+            (f64_t)blueprint->localOffset_x[i], (f64_t)blueprint->localOffset_y[i], (f64_t)blueprint->localOffset_z[i], i);
+    }
+    building_order_t* order_temp = order + BUILDING_NUM;
+#ifndef DSPBPTK_DONT_SORT_BUILDING
+    // 对建筑按建筑类型排序，有利于进一步压缩，非必要步骤
+    if(sort_building)
+        order = sort_building_order(order, order_temp, BUILDING_NUM);
+#else
+    (void)sort_building;
+#endif
+
+    // 重新生成index
+    id_map_attach(&id_map, order_temp + BUILDING_NUM);
+    for(size_t i = 0; i < BUILDING_NUM; i++)
+        id_map_insert(&id_map, blueprint->index[order[i].index], i);
+
+    // 按排序后的顺序编码建筑数组
+    for(size_t k = 0; k < BUILDING_NUM; k++) {
+        const size_t i = order[k].index;
+    #define BUILDING_ENCODE_SOA(name, type)\
+        *((type*)(ptr_bin + building_offset_##name)) = blueprint->name[i];
+        BUILDING_FIELDS(BUILDING_ENCODE_SOA)
+    #define BUILDING_REINDEX_SOA(name)\
+        *((i32_t*)(ptr_bin + building_offset_##name)) = (i32_t)re_index(blueprint->name[i], &id_map);
+        BUILDING_REINDEX_SOA(index);
+        BUILDING_REINDEX_SOA(tempOutputObjIdx);
+        BUILDING_REINDEX_SOA(tempInputObjIdx);
+
+        const size_t PARAMETERS_NUM = (size_t)(uint16_t)blueprint->num[i];
+        memcpy(ptr_bin + building_offset_parameters, blueprint->parameters + blueprint->parameters_offset[i], PARAMETERS_NUM * sizeof(i32_t));
+        ptr_bin += building_offset_parameters + PARAMETERS_NUM * sizeof(i32_t);
+    }
+
+    size_t bin_length = (size_t)(ptr_bin - bin);
+    return encode_payload(coder, string, head_length, bin, bin_length, string_capacity, compression_level);
+}
+
+
+
 ////////////////////////////////////////////////////////////////////////////////
 // dspbptk free blueprint
 ////////////////////////////////////////////////////////////////////////////////
 
 void dspbptk_free_blueprint(blueprint_t* blueprint) {
-    free(blueprint->shortDesc);
-    free(blueprint->md5f);
-    free(blueprint->area);
-    for(size_t i = 0; i < blueprint->BUILDING_NUM; i++) {
-        if(blueprint->building[i].num > 0)
-            free(blueprint->building[i].parameters);
+    const dspbptk_allocator_t* allocator = &blueprint->allocator;
+    dspbptk_free(allocator, blueprint->shortDesc);
+    dspbptk_free(allocator, blueprint->md5f);
+    dspbptk_free(allocator, blueprint->area);
+    if(blueprint->parameters_memory != NULL) {
+        // 解码得到的蓝图，所有参数列表共用一块内存
+        dspbptk_free(allocator, blueprint->parameters_memory);
+    }
+    else {
+        // 使用者自己构造的蓝图，每个参数列表单独分配
+        // num和编码时一样按无符号数处理，紧凑模式下32768个以上的参数列表也要释放
+        for(size_t i = 0; i < blueprint->BUILDING_NUM; i++) {
+            if((size_t)(uint16_t)blueprint->building[i].num > 0)
+                dspbptk_free(allocator, blueprint->building[i].parameters);
+        }
     }
-    free(blueprint->building);
+    dspbptk_free(allocator, blueprint->building);
+}
+
+void dspbptk_free_blueprint_soa(blueprint_soa_t* blueprint) {
+    const dspbptk_allocator_t* allocator = &blueprint->allocator;
+    dspbptk_free(allocator, blueprint->shortDesc);
+    dspbptk_free(allocator, blueprint->md5f);
+    dspbptk_free(allocator, blueprint->area);
+    dspbptk_free(allocator, blueprint->building_memory);
+}
+
+void dspbptk_free_view(blueprint_view_t* view) {
+    dspbptk_free(&view->allocator, view->building_offset);
 }
 
 
@@ -499,10 +1844,41 @@ void dspbptk_free_blueprint(blueprint_t* blueprint) {
 ////////////////////////////////////////////////////////////////////////////////
 
 void dspbptk_init_coder(dspbptk_coder_t* coder) {
-    coder->buffer0 = calloc(BLUEPRINT_MAX_LENGTH, 1);
-    coder->buffer1 = calloc(BLUEPRINT_MAX_LENGTH, 1);
-    coder->p_compressor = libdeflate_alloc_compressor(12);
-    coder->p_decompressor = libdeflate_alloc_decompressor();
+    dspbptk_init_coder_with_allocator(coder, NULL);
+}
+
+void dspbptk_init_coder_with_allocator(dspbptk_coder_t* coder, const dspbptk_allocator_t* allocator) {
+    base64_select();
+#ifndef DSPBPTK_COMPACT_BUILDING
+    unpack_building_select();
+#endif
+    memset(&coder->allocator, 0, sizeof(dspbptk_allocator_t));
+    if(allocator != NULL)
+        coder->allocator = *allocator;
+    coder->buffer0 = NULL;
+    coder->buffer1 = NULL;
+    coder->buffer0_capacity = 0;
+    coder->buffer1_capacity = 0;
+    coder->buffer0_mapped = 0;
+    coder->buffer1_mapped = 0;
+    coder->buffer_shrink_threshold = 0;
+    coder->buffer_huge_page = 0;
+    // 压缩器和解压器都在第一次用到时才创建
+    memset(coder->p_compressor, 0, sizeof(coder->p_compressor));
+    coder->p_decompressor = NULL;
+    coder->compression_level = COMPRESSION_LEVEL_MAX;
+    coder->decode_only = 0;
+    coder->thread_num = 1;
+#ifndef DSPBPTK_NO_WARNING
+    coder->md5f_verify = md5f_verify_interleaved;
+#else
+    coder->md5f_verify = md5f_verify_off;
+#endif
+}
+
+void dspbptk_init_decoder(dspbptk_coder_t* coder, const dspbptk_allocator_t* allocator) {
+    dspbptk_init_coder_with_allocator(coder, allocator);
+    coder->decode_only = 1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -510,8 +1886,183 @@ void dspbptk_init_coder(dspbptk_coder_t* coder) {
 ////////////////////////////////////////////////////////////////////////////////
 
 void dspbptk_free_coder(dspbptk_coder_t* coder) {
-    free(coder->buffer0);
-    free(coder->buffer1);
-    libdeflate_free_compressor(coder->p_compressor);
-    libdeflate_free_decompressor(coder->p_decompressor);
+    coder_buffer_free(coder, &coder->buffer0, &coder->buffer0_capacity, &coder->buffer0_mapped);
+    coder_buffer_free(coder, &coder->buffer1, &coder->buffer1_capacity, &coder->buffer1_mapped);
+    for(int level = 0; level <= COMPRESSION_LEVEL_MAX; level++)
+        libdeflate_free_compressor(coder->p_compressor[level]);
+    if(coder->p_decompressor != NULL)
+        libdeflate_free_decompressor(coder->p_decompressor);
+}
+
+
+
+////////////////////////////////////////////////////////////////////////////////
+// dspbptk coder pool
+////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+    atomic_int busy;    // 取出coder时用CAS从0改成1，归还时改回0
+    int created;        // 只由取到这个槽位的线程读写
+    size_t memory;      // 上次归还时coder缓冲区的大小
+}coder_slot_t;
+
+struct dspbptk_coder_pool {
+    dspbptk_allocator_t allocator;
+    size_t coder_num;
+    dspbptk_coder_t* coder;
+    coder_slot_t* slot;
+    atomic_size_t created;
+    atomic_size_t in_use;
+    atomic_size_t peak_in_use;
+    atomic_size_t waits;
+    atomic_size_t failures;
+    atomic_size_t memory;
+    atomic_size_t peak_memory;
+#ifndef DSPBPTK_NO_THREAD
+    // 只在没有空闲coder、需要等待时使用
+    atomic_size_t waiters;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+#endif
+};
+
+/**
+ * @brief 原子地把*peak更新为max(*peak, value)
+ */
+void atomic_size_max(atomic_size_t* peak, size_t value) {
+    size_t old = atomic_load(peak);
+    while(old < value && !atomic_compare_exchange_weak(peak, &old, value));
+}
+
+dspbptk_coder_pool_t* dspbptk_create_coder_pool(size_t coder_num, const dspbptk_allocator_t* allocator) {
+    dspbptk_allocator_t pool_allocator;
+    memset(&pool_allocator, 0, sizeof(dspbptk_allocator_t));
+    if(allocator != NULL)
+        pool_allocator = *allocator;
+
+    dspbptk_coder_pool_t* pool = (dspbptk_coder_pool_t*)dspbptk_calloc(&pool_allocator, 1, sizeof(dspbptk_coder_pool_t));
+    if(pool == NULL)
+        return NULL;
+    pool->allocator = pool_allocator;
+    pool->coder_num = coder_num;
+    pool->coder = (dspbptk_coder_t*)dspbptk_calloc(&pool_allocator, coder_num, sizeof(dspbptk_coder_t));
+    pool->slot = (coder_slot_t*)dspbptk_calloc(&pool_allocator, coder_num, sizeof(coder_slot_t));
+    if(pool->coder == NULL || pool->slot == NULL) {
+        dspbptk_free(&pool_allocator, pool->coder);
+        dspbptk_free(&pool_allocator, pool->slot);
+        dspbptk_free(&pool_allocator, pool);
+        return NULL;
+    }
+    for(size_t i = 0; i < coder_num; i++)
+        atomic_init(&pool->slot[i].busy, 0);
+    atomic_init(&pool->created, 0);
+    atomic_init(&pool->in_use, 0);
+    atomic_init(&pool->peak_in_use, 0);
+    atomic_init(&pool->waits, 0);
+    atomic_init(&pool->failures, 0);
+    atomic_init(&pool->memory, 0);
+    atomic_init(&pool->peak_memory, 0);
+#ifndef DSPBPTK_NO_THREAD
+    atomic_init(&pool->waiters, 0);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+#endif
+    return pool;
+}
+
+/**
+ * @brief 不等待地取出一个空闲的coder。从头开始找，已经创建过的coder优先被复用，池里的coder数量只增长到实际的并发数
+ *
+ * @return dspbptk_coder_t* 没有空闲的coder时返回NULL
+ */
+dspbptk_coder_t* coder_pool_try_acquire(dspbptk_coder_pool_t* pool) {
+    for(size_t i = 0; i < pool->coder_num; i++) {
+        coder_slot_t* slot = &pool->slot[i];
+        int expected = 0;
+        // 先读一次跳过忙的槽位，避免CAS反复抢缓存行。必须是seq_cst：等待的线程先加waiters再读busy，
+        // 归还的线程先写busy再读waiters，两边都是seq_cst才不会同时读到旧值而漏掉唤醒
+        if(atomic_load(&slot->busy) != 0 ||
+            !atomic_compare_exchange_strong(&slot->busy, &expected, 1))
+            continue;
+        if(!slot->created) {
+            dspbptk_init_coder_with_allocator(&pool->coder[i], &pool->allocator);
+            slot->created = 1;
+            atomic_fetch_add(&pool->created, 1);
+        }
+        atomic_size_max(&pool->peak_in_use, atomic_fetch_add(&pool->in_use, 1) + 1);
+        return &pool->coder[i];
+    }
+    return NULL;
+}
+
+dspbptk_coder_t* dspbptk_coder_pool_acquire(dspbptk_coder_pool_t* pool, int wait) {
+    dspbptk_coder_t* coder = coder_pool_try_acquire(pool);
+    if(coder != NULL)
+        return coder;
+#ifndef DSPBPTK_NO_THREAD
+    if(wait) {
+        atomic_fetch_add(&pool->waits, 1);
+        // 先登记再重新找一遍，归还的线程看到waiters不为0才会加锁唤醒。登记和两边的读都是seq_cst，这样不会漏掉唤醒
+        pthread_mutex_lock(&pool->mutex);
+        atomic_fetch_add(&pool->waiters, 1);
+        while((coder = coder_pool_try_acquire(pool)) == NULL)
+            pthread_cond_wait(&pool->cond, &pool->mutex);
+        atomic_fetch_sub(&pool->waiters, 1);
+        pthread_mutex_unlock(&pool->mutex);
+        return coder;
+    }
+#endif
+    atomic_fetch_add(&pool->failures, 1);
+    return NULL;
+}
+
+void dspbptk_coder_pool_release(dspbptk_coder_pool_t* pool, dspbptk_coder_t* coder) {
+    const size_t i = (size_t)(coder - pool->coder);
+    coder_slot_t* slot = &pool->slot[i];
+
+    // 更新内存统计，此时槽位还属于当前线程
+    const size_t memory = coder->buffer0_capacity + coder->buffer1_capacity;
+    if(memory >= slot->memory)
+        atomic_size_max(&pool->peak_memory, atomic_fetch_add(&pool->memory, memory - slot->memory) + memory - slot->memory);
+    else
+        atomic_fetch_sub(&pool->memory, slot->memory - memory);
+    slot->memory = memory;
+
+    atomic_fetch_sub(&pool->in_use, 1);
+    atomic_store(&slot->busy, 0);
+#ifndef DSPBPTK_NO_THREAD
+    if(atomic_load(&pool->waiters) > 0) {
+        pthread_mutex_lock(&pool->mutex);
+        pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+#endif
+}
+
+void dspbptk_coder_pool_stats(dspbptk_coder_pool_t* pool, dspbptk_coder_pool_stats_t* stats) {
+    stats->coder_num = pool->coder_num;
+    stats->created = atomic_load(&pool->created);
+    stats->in_use = atomic_load(&pool->in_use);
+    stats->peak_in_use = atomic_load(&pool->peak_in_use);
+    stats->waits = atomic_load(&pool->waits);
+    stats->failures = atomic_load(&pool->failures);
+    stats->memory = atomic_load(&pool->memory);
+    stats->peak_memory = atomic_load(&pool->peak_memory);
+}
+
+void dspbptk_free_coder_pool(dspbptk_coder_pool_t* pool) {
+    if(pool == NULL)
+        return;
+    for(size_t i = 0; i < pool->coder_num; i++) {
+        if(pool->slot[i].created)
+            dspbptk_free_coder(&pool->coder[i]);
+    }
+#ifndef DSPBPTK_NO_THREAD
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->cond);
+#endif
+    const dspbptk_allocator_t allocator = pool->allocator;
+    dspbptk_free(&allocator, pool->coder);
+    dspbptk_free(&allocator, pool->slot);
+    dspbptk_free(&allocator, pool);
 }
@@ -14,12 +14,15 @@ extern "C" {
 #include "Turbo-Base64/turbob64.h"
 
 #include "md5f.h"
+#include "enum_offset.h"
 
 // 可选的宏
 
 // #define DSPBPTK_DONT_SORT_BUILDING
+// #define DSPBPTK_COMPACT_BUILDING    // building_t按二进制流中的原始类型存储，内存占用约为1/3。库和使用者必须用相同的设置编译
 // #define DSPBPTK_NO_WARNING
 // #define DSPBPTK_NO_ERROR
+// #define DSPBPTK_NO_THREAD    // 不使用pthread，coder->thread_num被忽略
 
 // #define DSPBPTK_DEBUG
 
@@ -44,9 +47,26 @@ extern "C" {
         blueprint_base64_broken,
         blueprint_gzip_broken,
         blueprint_data_broken,
-        blueprint_md5f_broken
+        blueprint_md5f_broken,
+        coder_decode_only,
+        string_too_short
     }dspbptk_error_t;
 
+    // 解码时md5f的校验方式
+    typedef enum {
+        md5f_verify_off = 0,        // 不校验
+        md5f_verify_sync,           // base64解码前先完整计算一遍
+        md5f_verify_interleaved,    // 按块和base64解码交替计算，字符串只读一遍
+        md5f_verify_thread          // 在辅助线程中计算，和base64解码、gzip解压同时进行
+    }md5f_verify_t;
+
+    // md5f的校验结果
+    typedef enum {
+        md5f_unchecked = 0,         // 没有校验
+        md5f_ok,
+        md5f_mismatch               // 蓝图可能被改动过，数据仍然会正常解码
+    }md5f_status_t;
+
 
 
     ////////////////////////////////////////////////////////////////////////////
@@ -55,7 +75,14 @@ extern "C" {
 
 #define MD5F_LENGTH 32
 #define SHORTDESC_MAX_LENGTH 4096
+#define HEAD_MAX_LENGTH (256 + SHORTDESC_MAX_LENGTH)
 #define BLUEPRINT_MAX_LENGTH 134217728  // 128mb. 1048576 * 61 * 3/4 = 85284181.333 < 134217728.
+#define BASE64_CHUNK_LENGTH 65536  // 64kb. 解码时按块处理base64，必须是4和64的公倍数
+#define DECODE_PARALLEL_THRESHOLD 65536  // 建筑数量少于这个值时不值得开线程，总是单线程解析
+#define THREAD_MAX_NUM 64
+#define COMPRESSION_LEVEL_MAX 12  // libdeflate支持的最高压缩等级
+#define CODER_BUFFER_MIN_LENGTH 65536  // 64kb. coder的缓冲区按需分配，第一次至少分配这么多，之后按2倍扩容
+#define HUGE_PAGE_LENGTH 2097152  // 2mb. 开启coder->buffer_huge_page时，不小于这个大小的缓冲区用mmap分配，并按它对齐
 
 #define OBJ_NULL (-1)
 
@@ -75,6 +102,14 @@ extern "C" {
     typedef float f32_t;
     typedef double f64_t;
 
+    // 内存分配器。malloc_func为NULL时使用标准库的calloc/free。
+    // free_func可以为NULL，此时释放函数什么都不做，适合整体重置的arena
+    typedef struct {
+        void* (*malloc_func)(void* opaque, size_t size);
+        void (*free_func)(void* opaque, void* ptr);
+        void* opaque;
+    }dspbptk_allocator_t;
+
     typedef struct {
         f64_t x;
         f64_t y;
@@ -93,6 +128,7 @@ extern "C" {
         i64_t height;
     }area_t;
 
+#ifndef DSPBPTK_COMPACT_BUILDING
     typedef struct {
         i64_t index;
         i64_t areaIndex;
@@ -115,6 +151,37 @@ extern "C" {
         size_t num;
         i64_t* parameters;
     }building_t;
+#else
+    typedef struct {
+        f32_t x;
+        f32_t y;
+        f32_t z;
+    }f32x3_t;
+
+    // 与二进制流中的类型一致，按类型大小排列以避免填充
+    typedef struct {
+        i32_t* parameters;
+        i32_t index;
+        f32x3_t localOffset;
+        f32x3_t localOffset2;
+        f32_t yaw;
+        f32_t yaw2;
+        i32_t tempOutputObjIdx;
+        i32_t tempInputObjIdx;
+        i16_t itemId;
+        i16_t modelIndex;
+        i16_t recipeId;
+        i16_t filterId;
+        i16_t num;
+        i8_t areaIndex;
+        i8_t outputToSlot;
+        i8_t inputFromSlot;
+        i8_t outputFromSlot;
+        i8_t inputToSlot;
+        i8_t outputOffset;
+        i8_t inputOffset;
+    }building_t;
+#endif
 
     typedef struct {
         // head
@@ -135,17 +202,125 @@ extern "C" {
         area_t* area;
         size_t BUILDING_NUM;
         building_t* building;
+        // 解码时所有建筑的参数列表共用这一块内存，dspbptk_free_blueprint只释放它，不再逐个释放parameters。
+        // 自己构造蓝图时保持为NULL，此时每个parameters需要单独分配
+        void* parameters_memory;
         // md5f
         char* md5f;
+        md5f_status_t md5f_status;
+        // 解码时从coder复制，释放时使用
+        dspbptk_allocator_t allocator;
     }blueprint_t;
 
     typedef struct {
+        // head
+        i64_t layout;
+        i64_t icons[5];
+        i64_t time;
+        i64_t gameVersion[4];
+        char* shortDesc;
+        // base64
+        i64_t version;
+        i64_t cursorOffset_x;
+        i64_t cursorOffset_y;
+        i64_t cursorTargetArea;
+        i64_t dragBoxSize_x;
+        i64_t dragBoxSize_y;
+        i64_t primaryAreaIdx;
+        size_t AREA_NUM;
+        area_t* area;
+        size_t BUILDING_NUM;
+        // 建筑按列存储，每个字段一个连续数组，类型与二进制流中一致，字段名见enum_offset.h
+    #define BUILDING_SOA_FIELD(name, type) type* name;
+        BUILDING_FIELDS(BUILDING_SOA_FIELD)
+    #undef BUILDING_SOA_FIELD
+        size_t* parameters_offset;  // 第i个建筑的参数从parameters[parameters_offset[i]]开始，共num[i]个
+        i32_t* parameters;          // 所有建筑的参数首尾相接
+        void* building_memory;      // 以上各数组共用的一块内存
+        // md5f
+        char* md5f;
+        md5f_status_t md5f_status;
+        // 解码时从coder复制，释放时使用
+        dspbptk_allocator_t allocator;
+    }blueprint_soa_t;
+
+    typedef struct {
+        i64_t layout;
+        i64_t icons[5];
+        i64_t time;
+        i64_t gameVersion[4];
+        const char* shortDesc;  // 指向输入的蓝图字符串，不以'\0'结尾
+        size_t shortDesc_length;
+    }blueprint_head_t;
+
+    typedef struct {
+        blueprint_head_t head;
+        const char* md5f;           // 指向蓝图字符串，长度为MD5F_LENGTH，不以'\0'结尾
+        md5f_status_t md5f_status;
+        const void* bin;            // 指向coder中解压后的二进制流，下次使用coder前有效
+        size_t bin_length;
+        size_t AREA_NUM;
+        const void* area;           // 区域数组在二进制流中的起始位置
+        size_t BUILDING_NUM;
+        uint32_t* building_offset;  // 每个建筑的记录相对于bin的偏移量
+        dspbptk_allocator_t allocator;
+    }blueprint_view_t;
+
+    // 解码时的建筑筛选条件，各条件同时满足的建筑才会被解码
+    typedef struct {
+        const i16_t* itemId;        // 保留的itemId列表，为NULL时不按itemId筛选
+        size_t itemId_num;
+        const i8_t* areaIndex;      // 保留的areaIndex列表，为NULL时不按areaIndex筛选
+        size_t areaIndex_num;
+        // 对二进制流中的建筑记录(格式见enum_offset.h)做判断，返回非0时保留。为NULL时不使用
+        int (*callback)(void* opaque, const void* record);
+        void* opaque;
+    }dspbptk_filter_t;
+
+    typedef struct {
+        // 缓冲区按实际的输入长度分配，不够时按2倍扩容，之后的调用继续使用
         void* buffer0;
         void* buffer1;
-        struct libdeflate_compressor* p_compressor;
+        size_t buffer0_capacity;
+        size_t buffer1_capacity;
+        int buffer0_mapped;
+        int buffer1_mapped;
+        size_t buffer_shrink_threshold; // 缓冲区超过这个大小、而这次调用用不到那么多时释放后按需重新分配，默认为0表示从不缩小
+        int buffer_huge_page;           // 非0时，大缓冲区用mmap(MAP_NORESERVE)分配并建议内核使用透明大页，不经过allocator。只在Linux下有效，默认为0
+        // 压缩器按压缩等级缓存，第一次用这个等级编码时才创建；解压器在第一次解码时才创建
+        struct libdeflate_compressor* p_compressor[COMPRESSION_LEVEL_MAX + 1];
         struct libdeflate_decompressor* p_decompressor;
+        int compression_level;          // 编码时gzip的压缩等级(0~COMPRESSION_LEVEL_MAX)，默认为COMPRESSION_LEVEL_MAX
+        int decode_only;                // 由dspbptk_init_decoder初始化的coder不能编码，保证不会创建压缩器
+        dspbptk_allocator_t allocator;  // 缓冲区和解码结果都用它分配
+        size_t thread_num;              // 解码大蓝图时解析建筑数组的线程数，默认为1，初始化后可以直接修改，最多THREAD_MAX_NUM
+        md5f_verify_t md5f_verify;      // 解码时md5f的校验方式，默认为md5f_verify_interleaved，结果在解码得到的结构体的md5f_status中
     }dspbptk_coder_t;
 
+    // 单次编码的选项
+    typedef struct {
+        int compression_level;          // gzip的压缩等级(0~COMPRESSION_LEVEL_MAX)，每个等级的压缩器在coder中第一次用到时创建并缓存
+        int sort_building;              // 非0时按建筑种类、区域、位置排序后输出，压缩率更高；为0时按原来的顺序输出
+    }dspbptk_encode_options_t;
+
+    extern const dspbptk_encode_options_t dspbptk_encode_fast;      // 压缩等级1，不排序。适合编辑时频繁地重新编码
+    extern const dspbptk_encode_options_t dspbptk_encode_balanced;  // 压缩等级6，排序
+    extern const dspbptk_encode_options_t dspbptk_encode_smallest;  // 最高压缩等级，排序。和不指定选项时的默认设置相同
+
+    // 多个线程共用的一组coder，定义在libdspbptk.c中
+    typedef struct dspbptk_coder_pool dspbptk_coder_pool_t;
+
+    typedef struct {
+        size_t coder_num;       // 池中最多的coder数量
+        size_t created;         // 已经创建的coder数量，coder在第一次被取出时才创建
+        size_t in_use;          // 正在使用的coder数量
+        size_t peak_in_use;
+        size_t waits;           // 取coder时没有空闲的、需要等待的次数
+        size_t failures;        // 取coder时没有空闲的、不等待直接返回NULL的次数
+        size_t memory;          // 所有coder缓冲区的总大小，在归还coder时更新，不含libdeflate的压缩器/解压器
+        size_t peak_memory;
+    }dspbptk_coder_pool_stats_t;
+
 
 
     ////////////////////////////////////////////////////////////////////////////
@@ -162,7 +337,33 @@ extern "C" {
     dspbptk_error_t blueprint_decode(dspbptk_coder_t* coder, blueprint_t* blueprint, const char* string);
 
     /**
-     * @brief 蓝图编码。将blueprint_t编码成蓝图字符串
+     * @brief 蓝图解析。同blueprint_decode，但蓝图字符串由指针和长度给出，不需要以'\0'结尾，
+     * 适合直接解析mmap的文件或网络缓冲区
+     *
+     * @param blueprint 解析后的蓝图数据。使用结束后必须调用free_blueprint(blueprint)释放内存。
+     * @param string 解析前的蓝图字符串
+     * @param string_length 蓝图字符串的长度
+     * @return dspbptk_error_t 错误代码
+     */
+    dspbptk_error_t blueprint_decode_n(dspbptk_coder_t* coder, blueprint_t* blueprint, const char* string, size_t string_length);
+
+    /**
+     * @brief 蓝图解析，只解码符合filter条件的建筑。不符合条件的建筑只读取参数数量用于跳过，
+     * 不会展开成building_t，也不分配参数列表。保留下来的建筑中指向被筛掉的建筑的
+     * tempOutputObjIdx/tempInputObjIdx会被改为OBJ_NULL
+     *
+     * @param blueprint 解析后的蓝图数据。使用结束后必须调用free_blueprint(blueprint)释放内存。
+     * @param string 解析前的蓝图字符串
+     * @param string_length 蓝图字符串的长度
+     * @param filter 筛选条件，为NULL时等同于blueprint_decode_n
+     * @return dspbptk_error_t 错误代码
+     */
+    dspbptk_error_t blueprint_decode_filter(dspbptk_coder_t* coder, blueprint_t* blueprint, const char* string, size_t string_length, const dspbptk_filter_t* filter);
+
+    /**
+     * @brief 蓝图编码。将blueprint_t编码成蓝图字符串。不会修改blueprint
+     * 编码结果是确定的：相同的blueprint和编码选项总是得到逐字节相同的字符串(包括md5f)，与平台、libc和coder的其他设置无关。
+     * 建筑按建筑种类、所在区域、位置排序，这些都相同时保持原来的先后顺序
      *
      * @param blueprint 编码前的蓝图数据
      * @param string 编码后的蓝图字符串
@@ -170,6 +371,111 @@ extern "C" {
      */
     dspbptk_error_t blueprint_encode(dspbptk_coder_t* coder, const blueprint_t* blueprint, char* string);
 
+    /**
+     * @brief 同blueprint_encode，但检查string的容量，放不下时返回string_too_short，此时string的内容不确定
+     *
+     * @param string 编码后的蓝图字符串
+     * @param string_capacity string的容量，含结尾的'\0'。不小于blueprint_encode_bound(blueprint)时一定能放下
+     * @return dspbptk_error_t 错误代码
+     */
+    dspbptk_error_t blueprint_encode_n(dspbptk_coder_t* coder, const blueprint_t* blueprint, char* string, size_t string_capacity);
+
+    /**
+     * @brief 同blueprint_encode_n，但使用单独指定的编码选项
+     *
+     * @param options 编码选项，可以用dspbptk_encode_fast等预设。为NULL时使用coder->compression_level并排序
+     * @return dspbptk_error_t 错误代码
+     */
+    dspbptk_error_t blueprint_encode_opt(dspbptk_coder_t* coder, const blueprint_t* blueprint, char* string, size_t string_capacity, const dspbptk_encode_options_t* options);
+
+    /**
+     * @brief 返回蓝图编码后字符串长度的上限，含结尾的'\0'，可以用来为blueprint_encode准备刚好够用的字符串
+     *
+     * @param blueprint 编码前的蓝图数据
+     * @return size_t 按二进制流的准确长度和gzip压缩的最坏情况计算
+     */
+    size_t blueprint_encode_bound(const blueprint_t* blueprint);
+
+    /**
+     * @brief 只解析蓝图的head，遇到第一个双引号就停止。不做md5f校验、base64解码和gzip解压，也不分配任何内存
+     *
+     * @param head 解析后的head。其中shortDesc直接指向string，string释放后不可再使用
+     * @param string 蓝图字符串
+     * @return dspbptk_error_t 错误代码
+     */
+    dspbptk_error_t blueprint_peek_header(blueprint_head_t* head, const char* string);
+
+    /**
+     * @brief 蓝图只读解析。只建立每个建筑记录的偏移量索引，不把字段展开成building_t，
+     * 通过blueprint_view_*()系列函数直接读取二进制流中的字段
+     *
+     * @param view 解析后的蓝图视图，引用coder的缓冲区和string，下次使用coder前有效。使用结束后必须调用dspbptk_free_view(view)释放内存。
+     * @param string 解析前的蓝图字符串
+     * @return dspbptk_error_t 错误代码
+     */
+    dspbptk_error_t blueprint_view_decode(dspbptk_coder_t* coder, blueprint_view_t* view, const char* string);
+
+    /**
+     * @brief 批量校验蓝图的md5f，只解析head，不做base64解码和gzip解压。
+     * 多个蓝图在SIMD的多路中同时计算，适合校验大量蓝图
+     *
+     * @param string 蓝图字符串数组
+     * @param string_length 每个蓝图字符串的长度，为NULL时用strlen计算
+     * @param num 蓝图数量
+     * @param md5f_status 每个蓝图的校验结果，不是蓝图或head损坏时为md5f_unchecked
+     */
+    void blueprint_verify_batch(const char* const* string, const size_t* string_length, size_t num, md5f_status_t* md5f_status);
+
+    /**
+     * @brief 蓝图解析，建筑按列存储(SoA)。适合对大量建筑的单个字段做筛选、变换
+     *
+     * @param blueprint 解析后的蓝图数据。使用结束后必须调用dspbptk_free_blueprint_soa(blueprint)释放内存。
+     * @param string 解析前的蓝图字符串
+     * @return dspbptk_error_t 错误代码
+     */
+    dspbptk_error_t blueprint_decode_soa(dspbptk_coder_t* coder, blueprint_soa_t* blueprint, const char* string);
+
+    /**
+     * @brief 蓝图编码，建筑按列存储(SoA)。不会修改blueprint，结果和相同内容的blueprint_t用blueprint_encode编码时相同
+     *
+     * @param blueprint 编码前的蓝图数据
+     * @param string 编码后的蓝图字符串
+     * @return dspbptk_error_t 错误代码
+     */
+    dspbptk_error_t blueprint_encode_soa(dspbptk_coder_t* coder, const blueprint_soa_t* blueprint, char* string);
+
+    /**
+     * @brief 同blueprint_encode_soa，但检查string的容量并使用单独指定的编码选项。放不下时返回string_too_short，此时string的内容不确定
+     *
+     * @param string 编码后的蓝图字符串
+     * @param string_capacity string的容量，含结尾的'\0'。不小于blueprint_encode_soa_bound(blueprint)时一定能放下
+     * @param options 编码选项，为NULL时使用coder->compression_level并排序
+     * @return dspbptk_error_t 错误代码
+     */
+    dspbptk_error_t blueprint_encode_soa_opt(dspbptk_coder_t* coder, const blueprint_soa_t* blueprint, char* string, size_t string_capacity, const dspbptk_encode_options_t* options);
+
+    /**
+     * @brief 同blueprint_encode_bound，用于blueprint_soa_t。可以作为blueprint_encode_soa_opt的string_capacity
+     *
+     * @param blueprint 编码前的蓝图数据
+     * @return size_t 按二进制流的准确长度和gzip压缩的最坏情况计算
+     */
+    size_t blueprint_encode_soa_bound(const blueprint_soa_t* blueprint);
+
+    /**
+     * @brief 释放blueprint_soa_t结构体中的内存
+     *
+     * @param blueprint 需要释放内存的结构体
+     */
+    void dspbptk_free_blueprint_soa(blueprint_soa_t* blueprint);
+
+    /**
+     * @brief 释放blueprint_view_t结构体中的内存
+     *
+     * @param view 需要释放内存的结构体
+     */
+    void dspbptk_free_view(blueprint_view_t* view);
+
     /**
      * @brief 释放blueprint_t结构体中的内存
      *
@@ -179,17 +485,78 @@ extern "C" {
 
 
 
+    ////////////////////////////////////////////////////////////////////////////
+    // dspbptk view accessor
+    ////////////////////////////////////////////////////////////////////////////
+
+    // 按enum_offset.h生成的访问函数，返回二进制流中的原始值，例如：
+    // blueprint_view_version(view)
+    // blueprint_view_area_width(view, i)
+    // blueprint_view_building_itemId(view, i)
+
+#define BIN_HEAD_VIEW(name, type)\
+    static inline type blueprint_view_##name(const blueprint_view_t* view) {\
+        return *((const type*)((const char*)view->bin + bin_offset_##name));\
+    }
+    BIN_HEAD_FIELDS(BIN_HEAD_VIEW)
+#undef BIN_HEAD_VIEW
+
+#define AREA_VIEW(name, type)\
+    static inline type blueprint_view_area_##name(const blueprint_view_t* view, size_t i) {\
+        return *((const type*)((const char*)view->area + i * AREA_OFFSET_AREA_NEXT + area_offset_##name));\
+    }
+    AREA_FIELDS(AREA_VIEW)
+#undef AREA_VIEW
+
+#define BUILDING_VIEW(name, type)\
+    static inline type blueprint_view_building_##name(const blueprint_view_t* view, size_t i) {\
+        return *((const type*)((const char*)view->bin + view->building_offset[i] + building_offset_##name));\
+    }
+    BUILDING_FIELDS(BUILDING_VIEW)
+#undef BUILDING_VIEW
+
+    static inline i32_t blueprint_view_building_parameter(const blueprint_view_t* view, size_t i, size_t j) {
+        return *((const i32_t*)((const char*)view->bin + view->building_offset[i] + building_offset_parameters + j * sizeof(i32_t)));
+    }
+
+
+
     ////////////////////////////////////////////////////////////////////////////
     // dspbptk init coder
     ////////////////////////////////////////////////////////////////////////////
 
     /**
-     * @brief 初始化一个蓝图编码/解码器，请注意多线程不能使用同一个coder
+     * @brief 初始化一个蓝图编码/解码器，请注意多线程不能使用同一个coder。缓冲区在第一次编码/解码时才按需分配
      *
      * @param coder 待初始化的编码/解码器，使用结束后必须调用dspbptk_free_coder(coder)释放内存
      */
     void dspbptk_init_coder(dspbptk_coder_t* coder);
 
+    /**
+     * @brief 使用自定义的内存分配器初始化一个蓝图编码/解码器。
+     * coder的缓冲区和所有用这个coder解码得到的blueprint_t、blueprint_soa_t、blueprint_view_t都由allocator分配。
+     * libdeflate的压缩器/解压器仍使用libdeflate_set_memory_allocator设置的全局分配器
+     *
+     * @param coder 待初始化的编码/解码器，使用结束后必须调用dspbptk_free_coder(coder)释放内存
+     * @param allocator 内存分配器，会被复制到coder中。为NULL时等同于dspbptk_init_coder(coder)
+     */
+    void dspbptk_init_coder_with_allocator(dspbptk_coder_t* coder, const dspbptk_allocator_t* allocator);
+
+    /**
+     * @brief 初始化一个只用于解码的coder。编码函数对它返回coder_decode_only，不会创建占用内存较多的压缩器
+     *
+     * @param coder 待初始化的解码器，使用结束后必须调用dspbptk_free_coder(coder)释放内存
+     * @param allocator 内存分配器，为NULL时使用calloc/free
+     */
+    void dspbptk_init_decoder(dspbptk_coder_t* coder, const dspbptk_allocator_t* allocator);
+
+    /**
+     * @brief 返回当前使用的base64实现，第一次初始化coder时按CPU支持的指令集选择
+     *
+     * @return const char* "avx2"、"avx"、"ssse3"或"scalar"
+     */
+    const char* dspbptk_base64_impl(void);
+
 
 
     ////////////////////////////////////////////////////////////////////////////
@@ -205,6 +572,45 @@ extern "C" {
 
 
 
+    ////////////////////////////////////////////////////////////////////////////
+    // dspbptk coder pool
+    ////////////////////////////////////////////////////////////////////////////
+
+    /**
+     * @brief 创建一个可以被多个线程同时使用的coder池。取出、归还coder不加锁
+     *
+     * @param coder_num 池中最多的coder数量，同时最多有这么多个线程在编码/解码
+     * @param allocator 内存分配器，池和其中的coder都用它分配。为NULL时使用calloc/free
+     * @return dspbptk_coder_pool_t* 使用结束后必须调用dspbptk_free_coder_pool(pool)释放。内存不足时返回NULL
+     */
+    dspbptk_coder_pool_t* dspbptk_create_coder_pool(size_t coder_num, const dspbptk_allocator_t* allocator);
+
+    /**
+     * @brief 从池中取出一个coder，第一次取到的coder这时才初始化。
+     * coder的设置(thread_num、md5f_verify等)在归还后保留，下次取出时仍然有效
+     *
+     * @param wait 没有空闲的coder时，非0表示等待其他线程归还，0表示直接返回NULL。定义DSPBPTK_NO_THREAD时总是不等待
+     * @return dspbptk_coder_t* 取出的coder，使用结束后必须调用dspbptk_coder_pool_release(pool, coder)归还
+     */
+    dspbptk_coder_t* dspbptk_coder_pool_acquire(dspbptk_coder_pool_t* pool, int wait);
+
+    /**
+     * @brief 把取出的coder归还到池中。归还之后，用它解码得到的blueprint_view_t不再有效
+     */
+    void dspbptk_coder_pool_release(dspbptk_coder_pool_t* pool, dspbptk_coder_t* coder);
+
+    /**
+     * @brief 读取池的统计数据，可以在其他线程使用池的同时调用
+     */
+    void dspbptk_coder_pool_stats(dspbptk_coder_pool_t* pool, dspbptk_coder_pool_stats_t* stats);
+
+    /**
+     * @brief 释放池和其中所有的coder，调用时不能有未归还的coder
+     */
+    void dspbptk_free_coder_pool(dspbptk_coder_pool_t* pool);
+
+
+
     ////////////////////////////////////////////////////////////////////////////
     // dspbptk API
     ////////////////////////////////////////////////////////////////////////////
@@ -1,5 +1,7 @@
 #include "md5f.h"
 
+#include <string.h>
+
 uint32_t F(uint32_t x, uint32_t y, uint32_t z) {
     return (x & y) | (~x & z);
 }
@@ -40,157 +42,98 @@ void II(uint32_t* a, uint32_t b, uint32_t c, uint32_t d, uint32_t mj, int32_t s,
     *a += b;
 }
 
-void MD5_Append(uint32_t* buffer, size_t* buffer_len, const char* input, size_t input_len) {
-    int32_t num = 0;
-    int32_t num2 = 1;
-    int32_t num3 = 0;
-    int32_t num4 = input_len;
-    int32_t num5 = num4 % 64;
-
-    if(num5 < 56) {
-        num = 55 - num5;
-        num3 = num4 - num5 + 64;
-    }
-    else if(num5 == 56) {
-        num = 63;
-        num2 = 1;
-        num3 = num4 + 8 + 64;
-    }
-    else {
-        num = 63 - num5 + 56;
-        num3 = num4 + 64 - num5 + 64;
-    }
-
-    uint8_t* array = (uint8_t*)buffer;
-    *buffer_len = num3 / 4;
-
-    for(int32_t i = 0; i < input_len; i++) {
-        array[i] = input[i];
-    }
-    size_t index = input_len;
+void MD5_Init(uint32_t array[4]) {
+    array[0] = 1732584193u;
+    array[1] = 4024216457u;
+    array[2] = 2562383102u;
+    array[3] = 271734598u;
+}
 
-    if(num2 == 1) {
-        array[index++] = (uint8_t)128;
-    }
-    for(int32_t i = 0; i < num; i++) {
-        array[index++] = (uint8_t)0;
-    }
-    int64_t num6 = (int64_t)num4 * 8L;
-    uint8_t b = (uint8_t)(num6 & 0xFF);
-    uint8_t b2 = (uint8_t)(((uint64_t)num6 >> 8) & 0xFF);
-    uint8_t b3 = (uint8_t)(((uint64_t)num6 >> 16) & 0xFF);
-    uint8_t b4 = (uint8_t)(((uint64_t)num6 >> 24) & 0xFF);
-    uint8_t b5 = (uint8_t)(((uint64_t)num6 >> 32) & 0xFF);
-    uint8_t b6 = (uint8_t)(((uint64_t)num6 >> 40) & 0xFF);
-    uint8_t b7 = (uint8_t)(((uint64_t)num6 >> 48) & 0xFF);
-    uint8_t b8 = (uint8_t)((uint64_t)num6 >> 56);
-    array[index++] = (b);
-    array[index++] = (b2);
-    array[index++] = (b3);
-    array[index++] = (b4);
-    array[index++] = (b5);
-    array[index++] = (b6);
-    array[index++] = (b7);
-    array[index++] = (b8);
-
-}
-
-void MD5_Trasform(uint32_t array[4], uint32_t* buffer, size_t buffer_len) {
-    uint32_t A = 1732584193u;
-    uint32_t B = 4024216457u;
-    uint32_t C = 2562383102u;
-    uint32_t D = 271734598u;
-
-    for(int32_t i = 0; i < buffer_len; i += 16) {
-        uint32_t a = A;
-        uint32_t a2 = B;
-        uint32_t a3 = C;
-        uint32_t a4 = D;
-
-        FF(&a, a2, a3, a4, buffer[i], 7, 3614090360u);
-        FF(&a4, a, a2, a3, buffer[i + 1], 12, 3906451286u);
-        FF(&a3, a4, a, a2, buffer[i + 2], 17, 606105819u);
-        FF(&a2, a3, a4, a, buffer[i + 3], 22, 3250441966u);
-        FF(&a, a2, a3, a4, buffer[i + 4], 7, 4118548399u);
-        FF(&a4, a, a2, a3, buffer[i + 5], 12, 1200080426u);
-        FF(&a3, a4, a, a2, buffer[i + 6], 17, 2821735971u);
-        FF(&a2, a3, a4, a, buffer[i + 7], 22, 4249261313u);
-        FF(&a, a2, a3, a4, buffer[i + 8], 7, 1770035416u);
-        FF(&a4, a, a2, a3, buffer[i + 9], 12, 2336552879u);
-        FF(&a3, a4, a, a2, buffer[i + 10], 17, 4294925233u);
-        FF(&a2, a3, a4, a, buffer[i + 11], 22, 2304563134u);
-        FF(&a, a2, a3, a4, buffer[i + 12], 7, 1805586722u);
-        FF(&a4, a, a2, a3, buffer[i + 13], 12, 4254626195u);
-        FF(&a3, a4, a, a2, buffer[i + 14], 17, 2792965006u);
-        FF(&a2, a3, a4, a, buffer[i + 15], 22, 968099873u);
-        GG(&a, a2, a3, a4, buffer[i + 1], 5, 4129170786u);
-        GG(&a4, a, a2, a3, buffer[i + 6], 9, 3225465664u);
-        GG(&a3, a4, a, a2, buffer[i + 11], 14, 643717713u);
-        GG(&a2, a3, a4, a, buffer[i], 20, 3384199082u);
-        GG(&a, a2, a3, a4, buffer[i + 5], 5, 3593408605u);
-        GG(&a4, a, a2, a3, buffer[i + 10], 9, 38024275u);
-        GG(&a3, a4, a, a2, buffer[i + 15], 14, 3634488961u);
-        GG(&a2, a3, a4, a, buffer[i + 4], 20, 3889429448u);
-        GG(&a, a2, a3, a4, buffer[i + 9], 5, 569495014u);
-        GG(&a4, a, a2, a3, buffer[i + 14], 9, 3275163606u);
-        GG(&a3, a4, a, a2, buffer[i + 3], 14, 4107603335u);
-        GG(&a2, a3, a4, a, buffer[i + 8], 20, 1197085933u);
-        GG(&a, a2, a3, a4, buffer[i + 13], 5, 2850285829u);
-        GG(&a4, a, a2, a3, buffer[i + 2], 9, 4243563512u);
-        GG(&a3, a4, a, a2, buffer[i + 7], 14, 1735328473u);
-        GG(&a2, a3, a4, a, buffer[i + 12], 20, 2368359562u);
-        HH(&a, a2, a3, a4, buffer[i + 5], 4, 4294588738u);
-        HH(&a4, a, a2, a3, buffer[i + 8], 11, 2272392833u);
-        HH(&a3, a4, a, a2, buffer[i + 11], 16, 1839030562u);
-        HH(&a2, a3, a4, a, buffer[i + 14], 23, 4259657740u);
-        HH(&a, a2, a3, a4, buffer[i + 1], 4, 2763975236u);
-        HH(&a4, a, a2, a3, buffer[i + 4], 11, 1272893353u);
-        HH(&a3, a4, a, a2, buffer[i + 7], 16, 4139469664u);
-        HH(&a2, a3, a4, a, buffer[i + 10], 23, 3200236656u);
-        HH(&a, a2, a3, a4, buffer[i + 13], 4, 681279174u);
-        HH(&a4, a, a2, a3, buffer[i], 11, 3936430074u);
-        HH(&a3, a4, a, a2, buffer[i + 3], 16, 3572445317u);
-        HH(&a2, a3, a4, a, buffer[i + 6], 23, 76029189u);
-        HH(&a, a2, a3, a4, buffer[i + 9], 4, 3654602809u);
-        HH(&a4, a, a2, a3, buffer[i + 12], 11, 3873151461u);
-        HH(&a3, a4, a, a2, buffer[i + 15], 16, 530742520u);
-        HH(&a2, a3, a4, a, buffer[i + 2], 23, 3299628645u);
-        II(&a, a2, a3, a4, buffer[i], 6, 4096336452u);
-        II(&a4, a, a2, a3, buffer[i + 7], 10, 1126891415u);
-        II(&a3, a4, a, a2, buffer[i + 14], 15, 2878612391u);
-        II(&a2, a3, a4, a, buffer[i + 5], 21, 4237533241u);
-        II(&a, a2, a3, a4, buffer[i + 12], 6, 1700485571u);
-        II(&a4, a, a2, a3, buffer[i + 3], 10, 2399980690u);
-        II(&a3, a4, a, a2, buffer[i + 10], 15, 4293915773u);
-        II(&a2, a3, a4, a, buffer[i + 1], 21, 2240044497u);
-        II(&a, a2, a3, a4, buffer[i + 8], 6, 1873313359u);
-        II(&a4, a, a2, a3, buffer[i + 15], 10, 4264355552u);
-        II(&a3, a4, a, a2, buffer[i + 6], 15, 2734768916u);
-        II(&a2, a3, a4, a, buffer[i + 13], 21, 1309151649u);
-        II(&a, a2, a3, a4, buffer[i + 4], 6, 4149444226u);
-        II(&a4, a, a2, a3, buffer[i + 11], 10, 3174756917u);
-        II(&a3, a4, a, a2, buffer[i + 2], 15, 718787259u);
-        II(&a2, a3, a4, a, buffer[i + 9], 21, 3951481745u);
-
-        A += a;
-        B += a2;
-        C += a3;
-        D += a4;
-    }
+void MD5_Block(uint32_t array[4], const void* block) {
+    // block直接指向调用者的内存，不要求对齐
+    uint32_t buffer[16];
+    memcpy(buffer, block, 64);
+    uint32_t a = array[0];
+    uint32_t a2 = array[1];
+    uint32_t a3 = array[2];
+    uint32_t a4 = array[3];
 
-    array[0] = A;
-    array[1] = B;
-    array[2] = C;
-    array[3] = D;
+    FF(&a, a2, a3, a4, buffer[0], 7, 3614090360u);
+    FF(&a4, a, a2, a3, buffer[1], 12, 3906451286u);
+    FF(&a3, a4, a, a2, buffer[2], 17, 606105819u);
+    FF(&a2, a3, a4, a, buffer[3], 22, 3250441966u);
+    FF(&a, a2, a3, a4, buffer[4], 7, 4118548399u);
+    FF(&a4, a, a2, a3, buffer[5], 12, 1200080426u);
+    FF(&a3, a4, a, a2, buffer[6], 17, 2821735971u);
+    FF(&a2, a3, a4, a, buffer[7], 22, 4249261313u);
+    FF(&a, a2, a3, a4, buffer[8], 7, 1770035416u);
+    FF(&a4, a, a2, a3, buffer[9], 12, 2336552879u);
+    FF(&a3, a4, a, a2, buffer[10], 17, 4294925233u);
+    FF(&a2, a3, a4, a, buffer[11], 22, 2304563134u);
+    FF(&a, a2, a3, a4, buffer[12], 7, 1805586722u);
+    FF(&a4, a, a2, a3, buffer[13], 12, 4254626195u);
+    FF(&a3, a4, a, a2, buffer[14], 17, 2792965006u);
+    FF(&a2, a3, a4, a, buffer[15], 22, 968099873u);
+    GG(&a, a2, a3, a4, buffer[1], 5, 4129170786u);
+    GG(&a4, a, a2, a3, buffer[6], 9, 3225465664u);
+    GG(&a3, a4, a, a2, buffer[11], 14, 643717713u);
+    GG(&a2, a3, a4, a, buffer[0], 20, 3384199082u);
+    GG(&a, a2, a3, a4, buffer[5], 5, 3593408605u);
+    GG(&a4, a, a2, a3, buffer[10], 9, 38024275u);
+    GG(&a3, a4, a, a2, buffer[15], 14, 3634488961u);
+    GG(&a2, a3, a4, a, buffer[4], 20, 3889429448u);
+    GG(&a, a2, a3, a4, buffer[9], 5, 569495014u);
+    GG(&a4, a, a2, a3, buffer[14], 9, 3275163606u);
+    GG(&a3, a4, a, a2, buffer[3], 14, 4107603335u);
+    GG(&a2, a3, a4, a, buffer[8], 20, 1197085933u);
+    GG(&a, a2, a3, a4, buffer[13], 5, 2850285829u);
+    GG(&a4, a, a2, a3, buffer[2], 9, 4243563512u);
+    GG(&a3, a4, a, a2, buffer[7], 14, 1735328473u);
+    GG(&a2, a3, a4, a, buffer[12], 20, 2368359562u);
+    HH(&a, a2, a3, a4, buffer[5], 4, 4294588738u);
+    HH(&a4, a, a2, a3, buffer[8], 11, 2272392833u);
+    HH(&a3, a4, a, a2, buffer[11], 16, 1839030562u);
+    HH(&a2, a3, a4, a, buffer[14], 23, 4259657740u);
+    HH(&a, a2, a3, a4, buffer[1], 4, 2763975236u);
+    HH(&a4, a, a2, a3, buffer[4], 11, 1272893353u);
+    HH(&a3, a4, a, a2, buffer[7], 16, 4139469664u);
+    HH(&a2, a3, a4, a, buffer[10], 23, 3200236656u);
+    HH(&a, a2, a3, a4, buffer[13], 4, 681279174u);
+    HH(&a4, a, a2, a3, buffer[0], 11, 3936430074u);
+    HH(&a3, a4, a, a2, buffer[3], 16, 3572445317u);
+    HH(&a2, a3, a4, a, buffer[6], 23, 76029189u);
+    HH(&a, a2, a3, a4, buffer[9], 4, 3654602809u);
+    HH(&a4, a, a2, a3, buffer[12], 11, 3873151461u);
+    HH(&a3, a4, a, a2, buffer[15], 16, 530742520u);
+    HH(&a2, a3, a4, a, buffer[2], 23, 3299628645u);
+    II(&a, a2, a3, a4, buffer[0], 6, 4096336452u);
+    II(&a4, a, a2, a3, buffer[7], 10, 1126891415u);
+    II(&a3, a4, a, a2, buffer[14], 15, 2878612391u);
+    II(&a2, a3, a4, a, buffer[5], 21, 4237533241u);
+    II(&a, a2, a3, a4, buffer[12], 6, 1700485571u);
+    II(&a4, a, a2, a3, buffer[3], 10, 2399980690u);
+    II(&a3, a4, a, a2, buffer[10], 15, 4293915773u);
+    II(&a2, a3, a4, a, buffer[1], 21, 2240044497u);
+    II(&a, a2, a3, a4, buffer[8], 6, 1873313359u);
+    II(&a4, a, a2, a3, buffer[15], 10, 4264355552u);
+    II(&a3, a4, a, a2, buffer[6], 15, 2734768916u);
+    II(&a2, a3, a4, a, buffer[13], 21, 1309151649u);
+    II(&a, a2, a3, a4, buffer[4], 6, 4149444226u);
+    II(&a4, a, a2, a3, buffer[11], 10, 3174756917u);
+    II(&a3, a4, a, a2, buffer[2], 15, 718787259u);
+    II(&a2, a3, a4, a, buffer[9], 21, 3951481745u);
 
+    array[0] += a;
+    array[1] += a2;
+    array[2] += a3;
+    array[3] += a4;
 }
 
-void md5f(uint32_t md5f_u32[4], void* buffer, const char* stream, size_t stream_len) {
-    size_t buffer_len;
-
-    MD5_Append(buffer, &buffer_len, stream, stream_len);
-    MD5_Trasform(md5f_u32, buffer, buffer_len);
-
+void md5f(uint32_t md5f_u32[4], const char* stream, size_t stream_len) {
+    md5f_ctx_t ctx;
+    md5f_init(&ctx);
+    md5f_update(&ctx, stream, stream_len);
+    md5f_final(&ctx, md5f_u32);
 }
 
 void to_str(char* md5f_hex, uint32_t md5f_u32[4]) {
@@ -203,9 +146,259 @@ void to_str(char* md5f_hex, uint32_t md5f_u32[4]) {
     }
 }
 
-void md5f_str(char* md5f_hex, void* buffer, const char* stream, size_t stream_len) {
+void md5f_str(char* md5f_hex, const char* stream, size_t stream_len) {
     uint32_t md5f_u32[4];
-    md5f(md5f_u32, buffer, stream, stream_len);
+    md5f(md5f_u32, stream, stream_len);
     to_str(md5f_hex, md5f_u32);
 
-}
\ No newline at end of file
+}
+
+void md5f_init(md5f_ctx_t* ctx) {
+    MD5_Init(ctx->state);
+    ctx->length = 0;
+}
+
+void md5f_update(md5f_ctx_t* ctx, const void* stream, size_t stream_len) {
+    const uint8_t* ptr = (const uint8_t*)stream;
+    uint8_t* block = (uint8_t*)ctx->block;
+    size_t used = (size_t)(ctx->length % 64);
+    ctx->length += stream_len;
+
+    // 先补齐上次剩下的不完整块
+    if(used > 0) {
+        size_t fill = 64 - used;
+        if(stream_len < fill) {
+            memcpy(block + used, ptr, stream_len);
+            return;
+        }
+        memcpy(block + used, ptr, fill);
+        MD5_Block(ctx->state, ctx->block);
+        ptr += fill;
+        stream_len -= fill;
+    }
+
+    // 完整的块直接从调用者的内存读取，不复制
+    for(; stream_len >= 64; ptr += 64, stream_len -= 64)
+        MD5_Block(ctx->state, ptr);
+
+    memcpy(block, ptr, stream_len);
+}
+
+void md5f_final(md5f_ctx_t* ctx, uint32_t md5f_u32[4]) {
+    uint8_t* block = (uint8_t*)ctx->block;
+    size_t used = (size_t)(ctx->length % 64);
+    uint64_t bit_length = ctx->length * 8;
+
+    // 填充：0x80，若干个0，最后8字节小端序的比特长度
+    block[used++] = (uint8_t)128;
+    if(used > 56) {
+        memset(block + used, 0, 64 - used);
+        MD5_Block(ctx->state, ctx->block);
+        used = 0;
+    }
+    memset(block + used, 0, 56 - used);
+    for(int i = 0; i < 8; i++)
+        block[56 + i] = (uint8_t)(bit_length >> (8 * i));
+    MD5_Block(ctx->state, ctx->block);
+
+    memcpy(md5f_u32, ctx->state, sizeof(ctx->state));
+}
+
+void md5f_final_str(md5f_ctx_t* ctx, char* md5f_hex) {
+    uint32_t md5f_u32[4];
+    md5f_final(ctx, md5f_u32);
+    to_str(md5f_hex, md5f_u32);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// md5f multi-buffer
+////////////////////////////////////////////////////////////////////////////////
+
+// MD5_Block中64步的常数、消息字下标和循环左移位数
+static const uint32_t md5f_step_t[64] = {
+    3614090360u, 3906451286u, 606105819u, 3250441966u,
+    4118548399u, 1200080426u, 2821735971u, 4249261313u,
+    1770035416u, 2336552879u, 4294925233u, 2304563134u,
+    1805586722u, 4254626195u, 2792965006u, 968099873u,
+    4129170786u, 3225465664u, 643717713u, 3384199082u,
+    3593408605u, 38024275u, 3634488961u, 3889429448u,
+    569495014u, 3275163606u, 4107603335u, 1197085933u,
+    2850285829u, 4243563512u, 1735328473u, 2368359562u,
+    4294588738u, 2272392833u, 1839030562u, 4259657740u,
+    2763975236u, 1272893353u, 4139469664u, 3200236656u,
+    681279174u, 3936430074u, 3572445317u, 76029189u,
+    3654602809u, 3873151461u, 530742520u, 3299628645u,
+    4096336452u, 1126891415u, 2878612391u, 4237533241u,
+    1700485571u, 2399980690u, 4293915773u, 2240044497u,
+    1873313359u, 4264355552u, 2734768916u, 1309151649u,
+    4149444226u, 3174756917u, 718787259u, 3951481745u
+};
+static const uint8_t md5f_step_m[64] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    1, 6, 11, 0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12,
+    5, 8, 11, 14, 1, 4, 7, 10, 13, 0, 3, 6, 9, 12, 15, 2,
+    0, 7, 14, 5, 12, 3, 10, 1, 8, 15, 6, 13, 4, 11, 2, 9
+};
+static const uint8_t md5f_step_s[64] = {
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+};
+
+// 一次处理lane个互相独立的流各一个块。state按state[k * lane + l]存放第l个流的第k个字
+typedef void (*md5f_block_multi_t)(uint32_t* state, const uint8_t* const* block);
+
+// 用GCC的向量扩展生成lane路并行的MD5_Block，每一路是向量的一个元素。
+// 64步用查表的循环写出，由编译器完全展开
+#define MD5F_BLOCK_MULTI(lane, target)\
+    typedef uint32_t md5f_v##lane##_t __attribute__((vector_size(lane * sizeof(uint32_t))));\
+    target void md5f_block_x##lane(uint32_t* state, const uint8_t* const* block) {\
+        md5f_v##lane##_t m[16];\
+        for(int j = 0; j < 16; j++) {\
+            for(int l = 0; l < lane; l++) {\
+                uint32_t w;\
+                memcpy(&w, block[l] + j * sizeof(uint32_t), sizeof(uint32_t));\
+                m[j][l] = w;\
+            }\
+        }\
+        md5f_v##lane##_t v[4];\
+        memcpy(v, state, sizeof(v));\
+        md5f_v##lane##_t a = v[0], b = v[1], c = v[2], d = v[3];\
+        _Pragma("GCC unroll 64")\
+        for(int i = 0; i < 64; i++) {\
+            md5f_v##lane##_t f;\
+            if(i < 16)\
+                f = (b & c) | (~b & d);\
+            else if(i < 32)\
+                f = (b & d) | (c & ~d);\
+            else if(i < 48)\
+                f = b ^ c ^ d;\
+            else\
+                f = c ^ (b | ~d);\
+            f = f + a + m[md5f_step_m[i]] + md5f_step_t[i];\
+            a = d;\
+            d = c;\
+            c = b;\
+            b = b + ((f << md5f_step_s[i]) | (f >> (32 - md5f_step_s[i])));\
+        }\
+        v[0] += a;\
+        v[1] += b;\
+        v[2] += c;\
+        v[3] += d;\
+        memcpy(state, v, sizeof(v));\
+    }
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+MD5F_BLOCK_MULTI(4, __attribute__((target("sse2"))))
+MD5F_BLOCK_MULTI(8, __attribute__((target("avx2"))))
+MD5F_BLOCK_MULTI(16, __attribute__((target("avx512f"))))
+#else
+MD5F_BLOCK_MULTI(4, )
+#endif
+
+#define MD5F_LANE_MAX 16
+
+typedef struct {
+    const uint8_t* stream;  // 当前流，NULL表示这一路空闲
+    size_t job;             // 当前流的序号
+    size_t block_num;       // 流中完整的块数
+    size_t block_all;       // 加上填充块之后的总块数
+    size_t block_pos;
+    uint8_t tail[128];      // 末尾不足一块的部分和填充，1或2个块
+}md5f_lane_t;
+
+// 开始计算一个流，预先做好末尾的填充
+void md5f_lane_start(md5f_lane_t* lane, size_t job, const char* stream, size_t stream_len) {
+    const size_t used = stream_len % 64;
+    const uint64_t bit_length = (uint64_t)stream_len * 8;
+    lane->stream = (const uint8_t*)stream;
+    lane->job = job;
+    lane->block_num = stream_len / 64;
+    lane->block_pos = 0;
+    const size_t tail_len = used + 1 > 56 ? 128 : 64;
+    memcpy(lane->tail, stream + lane->block_num * 64, used);
+    lane->tail[used] = (uint8_t)128;
+    memset(lane->tail + used + 1, 0, tail_len - used - 1 - 8);
+    for(int i = 0; i < 8; i++)
+        lane->tail[tail_len - 8 + i] = (uint8_t)(bit_length >> (8 * i));
+    lane->block_all = lane->block_num + tail_len / 64;
+}
+
+/**
+ * @brief 用lane路并行的block_func计算多个流的md5f。每一路算完一个流就接着取下一个流，
+ * 长短不一的流不会让其他路空等
+ */
+void md5f_multi_lane(md5f_block_multi_t block_func, int lane_num,
+    uint32_t (*md5f_u32)[4], const char* const* stream, const size_t* stream_len, size_t stream_num) {
+    static const uint8_t idle_block[64] = {0};
+    md5f_lane_t lane[MD5F_LANE_MAX];
+    uint32_t state[4 * MD5F_LANE_MAX];
+    const uint8_t* block[MD5F_LANE_MAX];
+    size_t next_job = 0;
+    int active = 0;
+    for(int l = 0; l < lane_num; l++) {
+        lane[l].stream = NULL;
+        if(next_job < stream_num) {
+            md5f_lane_start(&lane[l], next_job, stream[next_job], stream_len[next_job]);
+            MD5_Init(md5f_u32[next_job]);
+            for(int k = 0; k < 4; k++)
+                state[k * lane_num + l] = md5f_u32[next_job][k];
+            next_job++;
+            active++;
+        }
+    }
+    while(active > 0) {
+        for(int l = 0; l < lane_num; l++) {
+            if(lane[l].stream == NULL)
+                block[l] = idle_block;
+            else if(lane[l].block_pos < lane[l].block_num)
+                block[l] = lane[l].stream + lane[l].block_pos * 64;
+            else
+                block[l] = lane[l].tail + (lane[l].block_pos - lane[l].block_num) * 64;
+        }
+        block_func(state, block);
+        for(int l = 0; l < lane_num; l++) {
+            if(lane[l].stream == NULL || ++lane[l].block_pos < lane[l].block_all)
+                continue;
+            // 这一路的流算完了，取出结果并换上下一个流
+            for(int k = 0; k < 4; k++)
+                md5f_u32[lane[l].job][k] = state[k * lane_num + l];
+            lane[l].stream = NULL;
+            active--;
+            if(next_job < stream_num) {
+                md5f_lane_start(&lane[l], next_job, stream[next_job], stream_len[next_job]);
+                uint32_t init[4];
+                MD5_Init(init);
+                for(int k = 0; k < 4; k++)
+                    state[k * lane_num + l] = init[k];
+                next_job++;
+                active++;
+            }
+        }
+    }
+}
+
+void md5f_multi(uint32_t (*md5f_u32)[4], const char* const* stream, const size_t* stream_len, size_t stream_num) {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        md5f_multi_lane(md5f_block_x16, 16, md5f_u32, stream, stream_len, stream_num);
+    else if(__builtin_cpu_supports("avx2"))
+        md5f_multi_lane(md5f_block_x8, 8, md5f_u32, stream, stream_len, stream_num);
+    else
+        md5f_multi_lane(md5f_block_x4, 4, md5f_u32, stream, stream_len, stream_num);
+#else
+    md5f_multi_lane(md5f_block_x4, 4, md5f_u32, stream, stream_len, stream_num);
+#endif
+}
+
+void md5f_multi_str(char (*md5f_hex)[33], const char* const* stream, const size_t* stream_len, size_t stream_num) {
+    uint32_t md5f_u32[64][4];
+    for(size_t i = 0; i < stream_num; i += 64) {
+        const size_t num = stream_num - i < 64 ? stream_num - i : 64;
+        md5f_multi(md5f_u32, stream + i, stream_len + i, num);
+        for(size_t j = 0; j < num; j++)
+            to_str(md5f_hex[i + j], md5f_u32[j]);
+    }
+}
@@ -8,8 +8,24 @@ extern "C" {
 #include <stdint.h>
 #include <stdio.h>
 
-void md5f(uint32_t md5f_u32[4], void* buffer, const char* stream, size_t stream_len);
-void md5f_str(char* md5f_hex, void* buffer, const char* stream, size_t stream_len);
+typedef struct {
+    uint32_t state[4];
+    uint64_t length;
+    uint32_t block[16];
+}md5f_ctx_t;
+
+void md5f(uint32_t md5f_u32[4], const char* stream, size_t stream_len);
+void md5f_str(char* md5f_hex, const char* stream, size_t stream_len);
+
+// 流式接口，可以分块计算md5f。完整的64字节块直接从输入读取，只有末尾不足一块的部分放在ctx中
+void md5f_init(md5f_ctx_t* ctx);
+void md5f_update(md5f_ctx_t* ctx, const void* stream, size_t stream_len);
+void md5f_final(md5f_ctx_t* ctx, uint32_t md5f_u32[4]);
+void md5f_final_str(md5f_ctx_t* ctx, char* md5f_hex);
+
+// 多路并行接口，同时计算多个互相独立的流的md5f，按CPU支持的指令集选择SSE2(4路)/AVX2(8路)/AVX-512(16路)
+void md5f_multi(uint32_t (*md5f_u32)[4], const char* const* stream, const size_t* stream_len, size_t stream_num);
+void md5f_multi_str(char (*md5f_hex)[33], const char* const* stream, const size_t* stream_len, size_t stream_num);
 
 #ifdef __cplusplus
 }